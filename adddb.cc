@@ -1,11 +1,43 @@
+#include <algorithm>
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <regex>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include <libgen.h>
 #include <unistd.h>
 #include "lmdb++.h"
+#include "keyfilter.hh"
+#include "metadata.hh"
+#include "valcodec.hh"
+
+namespace {
+
+// Target database, written sorted in one transaction.
+struct target {
+  std::string name;
+  lmdb::env env;
+  lmdb::batch_writer writer;
+  lmdbtools::value_codec codec;  // encoder of the values
+
+  static lmdb::env open(const std::string &dbfname, uint64_t mapsize) {
+    auto env = lmdb::env::create();
+    env.set_mapsize(mapsize * 1024UL * 1024UL);
+    env.open(dbfname.c_str(), MDB_NOSUBDIR | MDB_NOLOCK);
+    return env;
+  }
+
+  target(const std::string &dbfname, uint64_t mapsize)
+    : name(dbfname),
+      env(open(dbfname, mapsize)),
+      writer(env) {}
+};
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
   using namespace std;
@@ -13,24 +45,32 @@ int main(int argc, char *argv[]) {
   uint64_t mapsize = 1024UL * 1024UL;  // lmdb map size in MiB
   int verbose = 0;  // verbose output
   string pattern = "";  // regular expression pattern
+  string patternfile = "";  // file of patterns and their target databases
   bool overwrite = false;  // overwrite new value for a duplicate key
   bool deleteval = false;  // delete value
 
   string progname = basename(argv[0]);
   string usage = "usage: " + progname +
     " [options] <targetdb> [<dbname> ...]\n"
+    "       " + progname + " [options] -f <file> [<dbname> ...]\n"
     "options: -p <string>  regular expression pattern for key\n"
+    "         -f <file>    add the keys matching each pattern of a file of\n"
+    "                      <regex> TAB <targetdb> lines to its target\n"
+    "                      database in a single scan\n"
     "         -o           overwrite new value for a duplicate key\n"
     "         -D           delete value\n"
     "         -m <size>    lmdb map size in MiB (" + to_string(mapsize) + ")\n"
-    "         -v           verbose output\n"
+    "         -v           verbose output; -vv lists the keys already present"
+    + string(lmdb::instrument::enabled
+             ? "\n                      and adds lmdb call statistics\n" : "\n")
     ;
   for (opterr = 0;;) {
-    int opt = getopt(argc, argv, ":p:oDm:v");
+    int opt = getopt(argc, argv, ":p:f:oDm:v");
     if (opt == -1) break;
     try {
       switch (opt) {
         case 'p': { pattern = optarg; break; }
+        case 'f': { patternfile = optarg; break; }
         case 'o': { overwrite = true; break; }
         case 'D': { deleteval = true; break; }
         case 'm': { mapsize = stoul(optarg); break; }
@@ -51,28 +91,80 @@ int main(int argc, char *argv[]) {
       exit(EXIT_FAILURE);
     }
   }
-  if (argc - optind < 1) {
+  if (patternfile.empty() && argc - optind < 1) {
     cout << "too few arguments\n" << usage << flush;
     exit(EXIT_FAILURE);
   }
+  if (verbose > 1) {
+    lmdb::instrument::print_at_exit();
+  }
+  if (!patternfile.empty() && !pattern.empty()) {
+    cout << "-f cannot be combined with -p\n" << usage << flush;
+    exit(EXIT_FAILURE);
+  }
 
   int oi = optind;
-  string odbfname(argv[oi++]);
 
   const unsigned int put_flags = (overwrite ? 0 : MDB_NOOVERWRITE);
 
   try {
-    auto env0 = lmdb::env::create();
-    env0.set_mapsize(mapsize * 1024UL * 1024UL);
-    env0.open(odbfname.c_str(), MDB_NOSUBDIR | MDB_NOLOCK);
-
-    auto wtxn0 = lmdb::txn::begin(env0, nullptr);
-    auto dbi0  = lmdb::dbi::open(wtxn0);
+    // each pattern routes the keys it matches to one target database
+    lmdbtools::pattern_set patterns;
+    vector<size_t> routes;
+    vector<string> tdbfnames;
+    if (patternfile.empty()) {
+      tdbfnames.push_back(argv[oi++]);
+      patterns.add(pattern);
+      routes.push_back(0);
+    } else {
+      map<string, size_t> destinations;
+      for (const auto &route : lmdbtools::read_routes(patternfile)) {
+        try {
+          patterns.add(route.first);
+        }
+        catch (const regex_error &e) {
+          throw runtime_error(patternfile + ": " + e.what() + ": pattern: "
+                              + route.first);
+        }
+        auto it = destinations.find(route.second);
+        if (it == destinations.end()) {
+          tdbfnames.push_back(route.second);
+          it = destinations.emplace(route.second, tdbfnames.size() - 1).first;
+        }
+        routes.push_back(it->second);
+      }
+    }
+    patterns.build();
 
-    if (verbose > 0) {
-      cerr << odbfname << endl;
+    // a new target takes the dictionary of the first database added
+    const auto first = oi < argc ? lmdbtools::value_codec::of(argv[oi])
+                                 : lmdbtools::value_codec();
+    vector<target> targets;
+    targets.reserve(tdbfnames.size());
+    for (const auto &tdbfname : tdbfnames) {
+      if (verbose > 0) {
+        cerr << tdbfname << endl;
+      }
+      targets.emplace_back(tdbfname, mapsize);
+      lmdbtools::comparator::of(tdbfname).apply(targets.back().writer);
+      targets.back().codec = first.adopt(tdbfname, targets.back().writer);
+      // appended values reach storage before the entries that refer to
+      // them; the reserved targets stay in place
+      target *const tgt = &targets.back();
+      tgt->writer.on_commit([tgt]() { tgt->codec.sync(); });
+      if (verbose > 1) {
+        targets.back().writer.on_exist([](const MDB_val &key) {
+          const string keystr(static_cast<const char *>(key.mv_data),
+                              key.mv_size);
+          cerr << "== " << keystr << endl;
+        });
+      }
     }
 
+    vector<size_t> ids;
+    vector<size_t> hits;
+    vector<bool> same(targets.size());
+    string buf, buf0;  // decoded and encoded values
     for (int i = oi; i < argc; ++i) {
       if (verbose > 0) {
         cerr << "+ " << argv[i] << endl;
@@ -81,50 +173,40 @@ int main(int argc, char *argv[]) {
       env.set_mapsize(mapsize * 1024UL * 1024UL);
       env.open(argv[i], MDB_NOSUBDIR | MDB_NOLOCK | MDB_RDONLY);
 
+      const auto cmp = lmdbtools::comparator::of(argv[i]);
       auto rtxn   = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
       auto dbi    = lmdb::dbi::open(rtxn);
+      cmp.apply(rtxn, dbi);
 
+      // values are copied as they are stored into the targets with the
+      // same dictionary, without decoding them
+      auto codec = lmdbtools::value_codec::of(argv[i]);
+      for (size_t t = 0; t < targets.size(); ++t) {
+        same[t] = targets[t].codec == codec;
+      }
+
+      // only the keys starting with the literal prefix shared by the
+      // patterns are visited, if they are adjacent in the key order
       auto cursor = lmdb::cursor::open(rtxn, dbi);
-      lmdb::val key;
-      lmdb::val val;
-
-      if (deleteval) {
-        lmdb::val empty("");
-        if (pattern.empty()) {
-          while (cursor.get(key, val, MDB_NEXT)) {
-            dbi0.put(wtxn0, key, empty);
-          }
-        } else {
-          const regex pat(pattern);
-          while (cursor.get(key, val, MDB_NEXT)) {
-            string keystr(key.data(), key.size());
-            if (regex_search(keystr, pat)) {
-              dbi0.put(wtxn0, key, empty);
-            }
-          }
+      lmdb::val empty("");
+      const string prefix = cmp.bytewise() ? patterns.prefix() : string();
+      for (const auto &e : cursor.prefix(prefix)) {
+        patterns.match(e.key.data(), e.key.size(), ids);
+        hits.clear();
+        for (const size_t id : ids) {
+          hits.push_back(routes[id]);
         }
-      } else {
-        if (pattern.empty()) {
-          while (cursor.get(key, val, MDB_NEXT)) {
-            if (!dbi0.put(wtxn0, key, val, put_flags)) {
-              if (verbose > 1) {
-                const string keystr(key.data(), key.size());
-                cerr << "== " << keystr << endl;
-              }
-            }
-          }
-        } else {
-          const regex pat(pattern);
-          while (cursor.get(key, val, MDB_NEXT)) {
-            string keystr(key.data(), key.size());
-            if (regex_search(keystr, pat)) {
-              if (!dbi0.put(wtxn0, key, val, put_flags)) {
-                if (verbose > 1) {
-                  const string keystr(key.data(), key.size());
-                  cerr << "== " << keystr << endl;
-                }
-              }
-            }
+        sort(hits.begin(), hits.end());
+        hits.erase(unique(hits.begin(), hits.end()), hits.end());
+        for (const size_t t : hits) {
+          target &tgt = targets[t];
+          if (deleteval) {
+            tgt.writer.put(e.key, tgt.codec.encode(empty, buf0));
+          } else if (same[t]) {
+            tgt.writer.put(e.key, e.value, put_flags);
+          } else {
+            tgt.writer.put(e.key, tgt.codec.encode(codec.decode(e.value, buf),
+                                                   buf0), put_flags);
           }
         }
       }
@@ -132,13 +214,23 @@ int main(int argc, char *argv[]) {
       rtxn.abort();
     }
 
-    MDB_stat st = dbi0.stat(wtxn0);
-    cout << odbfname << '\t' << st.ms_entries << endl;
-    wtxn0.commit();
+    for (auto &tgt : targets) {
+      MDB_stat st = tgt.writer.stat();
+      cout << tgt.name << '\t' << st.ms_entries << endl;
+      tgt.writer.commit();
+    }
   }
   catch (const lmdb::error &e) {
     cerr << e.what() << endl;
     return EXIT_FAILURE;
   }
+  catch (const regex_error &e) {
+    cerr << e.what() << ": pattern: " << pattern << endl;
+    return EXIT_FAILURE;
+  }
+  catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,158 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <libgen.h>
+#include <unistd.h>
+#include "../lmdb++.h"
+
+namespace {
+
+// Runs `op` the given number of rounds and returns the mean wall time of
+// one of its `count` calls in nanoseconds; the sizes it returns are summed
+// into `sink` so that the calls are not optimized away.
+template <typename Op>
+double measure(unsigned int rounds, size_t count, size_t &sink, const Op &op) {
+  const auto start = std::chrono::steady_clock::now();
+  for (unsigned int r = 0; r < rounds; ++r) {
+    sink += op();
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return count ? elapsed.count() / (double(rounds) * count) : 0.0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  using namespace std;
+
+  uint64_t mapsize = 1024UL * 1024UL;  // lmdb map size in MiB
+  size_t maxkeys = 1000000;  // keys looked up per round
+  unsigned int rounds = 10;  // rounds of each variant
+
+  string progname = basename(argv[0]);
+  string usage = "usage: " + progname + " [options] <dbname>\n"
+    "compares point lookups and a cursor pass through the raw C API, the\n"
+    "non-throwing try_* wrappers and the throwing wrappers\n"
+    "options: -n <count>  keys looked up per round (" + to_string(maxkeys) + ")\n"
+    "         -r <num>    rounds of each variant (" + to_string(rounds) + ")\n"
+    "         -m <size>   lmdb map size in MiB (" + to_string(mapsize) + ")\n"
+    ;
+  for (opterr = 0;;) {
+    int opt = getopt(argc, argv, ":n:r:m:");
+    if (opt == -1) break;
+    try {
+      switch (opt) {
+        case 'n': { maxkeys = stoul(optarg); break; }
+        case 'r': { rounds = stoul(optarg);
+                    if (rounds < 1) throw 0;
+                    break; }
+        case 'm': { mapsize = stoul(optarg); break; }
+        case ':': { cout << "missing argument of -"
+                    << static_cast<char>(optopt) << endl;
+                    exit(EXIT_FAILURE);
+                  }
+        case '?':
+        default:  { cout << "unknown option -"
+                    << static_cast<char>(optopt) << '\n' << usage << flush;
+                    exit(EXIT_FAILURE);
+                  }
+      }
+    }
+    catch (...) {
+      cout << "invalid argument: " << argv[optind - 1] << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (argc - optind != 1) {
+    cout << "wrong number of arguments\n" << usage << flush;
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    auto env = lmdb::env::create();
+    env.set_mapsize(mapsize * 1024UL * 1024UL);
+    env.open(argv[optind], MDB_NOSUBDIR | MDB_NOLOCK | MDB_RDONLY);
+    auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+    auto dbi = lmdb::dbi::open(rtxn);
+    MDB_txn *const txn = rtxn;
+    const MDB_dbi d = dbi;
+
+    // every n-th key, so that the lookups spread over the database
+    const size_t entries = dbi.size(rtxn);
+    const size_t step = maxkeys && entries > maxkeys ? entries / maxkeys : 1;
+    vector<string> keys;
+    {
+      auto cursor = lmdb::cursor::open(rtxn, dbi);
+      size_t n = 0;
+      for (const auto &e : cursor.range()) {
+        if (n++ % step == 0 && keys.size() < maxkeys) {
+          keys.emplace_back(e.key.data(), e.key.size());
+        }
+      }
+    }
+    vector<MDB_val> vals;
+    for (auto &k : keys) {
+      vals.push_back(MDB_val{k.size(), &k[0]});
+    }
+
+    size_t sink = 0;
+    auto lookups = [&](const char *name, auto get) {
+      const double ns = measure(rounds, vals.size(), sink, [&]() {
+        size_t total = 0;
+        MDB_val data;
+        for (const MDB_val &key : vals) {
+          if (get(&key, &data)) total += data.mv_size;
+        }
+        return total;
+      });
+      cout << name << '\t' << fixed << setprecision(1) << ns << " ns\n";
+    };
+    lookups("mdb_get", [&](const MDB_val *key, MDB_val *data) {
+      return ::mdb_get(txn, d, const_cast<MDB_val *>(key), data)
+        == MDB_SUCCESS;
+    });
+    lookups("lmdb::try_dbi_get", [&](const MDB_val *key, MDB_val *data) {
+      return lmdb::try_dbi_get(txn, d, key, data).ok();
+    });
+    lookups("lmdb::dbi_get", [&](const MDB_val *key, MDB_val *data) {
+      return lmdb::dbi_get(txn, d, key, data);
+    });
+
+    auto cursor = lmdb::cursor::open(rtxn, dbi);
+    MDB_cursor *const c = cursor;
+    auto scan = [&](const char *name, auto next) {
+      const double ns = measure(rounds, entries, sink, [&]() {
+        size_t total = 0;
+        MDB_val key, data;
+        for (MDB_cursor_op op = MDB_FIRST; next(&key, &data, op);
+             op = MDB_NEXT) {
+          total += data.mv_size;
+        }
+        return total;
+      });
+      cout << name << '\t' << fixed << setprecision(1) << ns << " ns\n";
+    };
+    scan("mdb_cursor_get", [&](MDB_val *key, MDB_val *data, MDB_cursor_op op) {
+      return ::mdb_cursor_get(c, key, data, op) == MDB_SUCCESS;
+    });
+    scan("lmdb::try_cursor_get",
+         [&](MDB_val *key, MDB_val *data, MDB_cursor_op op) {
+      return lmdb::try_cursor_get(c, key, data, op).ok();
+    });
+    scan("lmdb::cursor_get", [&](MDB_val *key, MDB_val *data, MDB_cursor_op op) {
+      return lmdb::cursor_get(c, key, data, op);
+    });
+    if (sink == 0) {
+      cerr << "empty database" << endl;
+    }
+  }
+  catch (const lmdb::error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
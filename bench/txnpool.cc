@@ -0,0 +1,120 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <libgen.h>
+#include <unistd.h>
+#include "../lmdb++.h"
+
+namespace {
+
+// Runs `op` the given number of times on each of the threads and returns
+// the mean wall time of one call in nanoseconds.
+template <typename Op>
+double measure(unsigned int nthreads, uint64_t iterations, const Op &op) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < nthreads; ++t) {
+    workers.emplace_back([&op, iterations]() {
+      for (uint64_t n = 0; n < iterations; ++n) op();
+    });
+  }
+  for (auto &w : workers) w.join();
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  using namespace std;
+
+  uint64_t mapsize = 1024UL * 1024UL;  // lmdb map size in MiB
+  uint64_t iterations = 1000000;  // snapshots acquired per thread
+  unsigned int nthreads = 1;  // number of reader threads
+
+  string progname = basename(argv[0]);
+  string usage = "usage: " + progname + " [options] <dbname>\n"
+    "compares the cost of a read-only snapshot taken with txn::begin and\n"
+    "with txn_pool::acquire, each followed by a cursor read of the first key\n"
+    "options: -n <count>  snapshots per thread (" + to_string(iterations) + ")\n"
+    "         -t <num>    number of reader threads (" + to_string(nthreads) + ")\n"
+    "         -m <size>   lmdb map size in MiB (" + to_string(mapsize) + ")\n"
+    ;
+  for (opterr = 0;;) {
+    int opt = getopt(argc, argv, ":n:t:m:");
+    if (opt == -1) break;
+    try {
+      switch (opt) {
+        case 'n': { iterations = stoul(optarg);
+                    if (iterations < 1) throw 0;
+                    break; }
+        case 't': { nthreads = stoul(optarg);
+                    if (nthreads < 1) throw 0;
+                    break; }
+        case 'm': { mapsize = stoul(optarg); break; }
+        case ':': { cout << "missing argument of -"
+                    << static_cast<char>(optopt) << endl;
+                    exit(EXIT_FAILURE);
+                  }
+        case '?':
+        default:  { cout << "unknown option -"
+                    << static_cast<char>(optopt) << '\n' << usage << flush;
+                    exit(EXIT_FAILURE);
+                  }
+      }
+    }
+    catch (...) {
+      cout << "invalid argument: " << argv[optind - 1] << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (argc - optind != 1) {
+    cout << "wrong number of arguments\n" << usage << flush;
+    exit(EXIT_FAILURE);
+  }
+
+  try {
+    auto env = lmdb::env::create();
+    env.set_mapsize(mapsize * 1024UL * 1024UL);
+    env.open(argv[optind], MDB_NOSUBDIR | MDB_NOTLS | MDB_RDONLY);
+
+    MDB_dbi dbi;
+    {
+      auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+      dbi = lmdb::dbi::open(rtxn).handle();
+      rtxn.commit();
+    }
+
+    auto read_first = [dbi](MDB_txn *txn) {
+      auto cursor = lmdb::cursor::open(txn, dbi);
+      lmdb::val key, val;
+      cursor.get(key, val, MDB_FIRST);
+    };
+
+    const double begun = measure(nthreads, iterations, [&]() {
+      auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+      read_first(rtxn);
+    });
+
+    lmdb::txn_pool pool(env);
+    const double pooled = measure(nthreads, iterations, [&]() {
+      auto snap = pool.acquire();
+      read_first(snap);
+    });
+
+    cout << fixed << setprecision(1)
+         << "txn::begin\t" << begun << " ns\n"
+         << "txn_pool::acquire\t" << pooled << " ns\n"
+         << "speedup\t" << begun / pooled << endl;
+  }
+  catch (const lmdb::error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#ifndef LMDBTOOLS_BLOBFILE_HH
+#define LMDBTOOLS_BLOBFILE_HH
+
+/**
+ * Append-only file of the large values of a database.
+ *
+ * A value of more than about half a page goes on a run of LMDB overflow
+ * pages of its own, which spreads the entries over many more pages than
+ * their keys need. The large values of database `<db>` can instead be
+ * appended to `<db>-blob`, next to the `<db>-meta` and `<db>-filter`
+ * sidecars, and the database only refers to them, so that passes over the
+ * keys stay within small, dense pages. The file is only ever appended to:
+ * the bytes of a value that is overwritten or deleted stay behind until
+ * the database is rewritten into a new one.
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lmdbtools {
+
+class blob_file {
+  const std::string _path;
+  std::once_flag _opened;
+  int _rfd{-1};  // opened on the first read
+  int _rerrno{0};  // errno of a failed open for reading
+  int _wfd{-1};  // opened on the first append
+  std::uint64_t _end{0};  // offset of the next append
+
+  [[noreturn]] void raise(const char* what) const {
+    throw std::system_error(errno, std::system_category(),
+                            _path + ": " + what);
+  }
+
+public:
+  explicit blob_file(std::string path)
+    : _path(std::move(path)) {}
+
+  blob_file(const blob_file&) = delete;
+  blob_file& operator=(const blob_file&) = delete;
+
+  ~blob_file() noexcept {
+    if (_rfd >= 0) ::close(_rfd);
+    if (_wfd >= 0) ::close(_wfd);
+  }
+
+  const std::string& path() const noexcept { return _path; }
+
+  /**
+   * Appends bytes and returns their offset. Appends come from one thread.
+   *
+   * @throws std::system_error on failure
+   */
+  std::uint64_t append(const char* data, std::size_t size) {
+    if (_wfd < 0) {
+      _wfd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644);
+      if (_wfd < 0) raise("open");
+      const off_t end = ::lseek(_wfd, 0, SEEK_END);
+      if (end < 0) raise("lseek");
+      _end = end;
+    }
+    const std::uint64_t offset = _end;
+    while (size > 0) {
+      const ssize_t n = ::write(_wfd, data, size);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        raise("write");
+      }
+      data += n;
+      size -= n;
+      _end += n;
+    }
+    return offset;
+  }
+
+  /**
+   * Reads `size` bytes at `offset` into `buf`. Any thread may read.
+   *
+   * @retval false if the file ends before them
+   * @throws std::system_error on failure
+   */
+  bool read(std::uint64_t offset, std::size_t size, std::string& buf) {
+    std::call_once(_opened, [this]() {
+      _rfd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+      _rerrno = errno;
+    });
+    if (_rfd < 0) {
+      errno = _rerrno;
+      raise("open");
+    }
+    // the offset and size come from stored bytes: check them against the
+    // file before allocating for them
+    struct stat st;
+    if (::fstat(_rfd, &st) != 0) raise("fstat");
+    const std::uint64_t end = st.st_size;
+    if (offset > end || size > end - offset) return false;
+    buf.resize(size);
+    for (std::size_t done = 0; done < size;) {
+      const ssize_t n = ::pread(_rfd, &buf[done], size - done, offset + done);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        raise("pread");
+      }
+      if (n == 0) return false;
+      done += n;
+    }
+    return true;
+  }
+
+  /**
+   * Flushes the appended bytes to storage, ahead of the commit of the
+   * entries that refer to them.
+   *
+   * @throws std::system_error on failure
+   */
+  void sync() {
+    if (_wfd >= 0 && ::fdatasync(_wfd) != 0) raise("fdatasync");
+  }
+
+  /**
+   * Returns the blob file path of database `dbname`.
+   */
+  static std::string path_of(const std::string& dbname) {
+    return dbname + "-blob";
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_BLOBFILE_HH
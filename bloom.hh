@@ -0,0 +1,231 @@
+#ifndef LMDBTOOLS_BLOOM_HH
+#define LMDBTOOLS_BLOOM_HH
+
+/**
+ * Blocked Bloom filter over the keys of a database, stored as a sidecar
+ * file `<dbname>-filter` next to the database.
+ *
+ * Each key sets its bits within a single 64-byte block, so a membership
+ * test costs one cache miss. The file carries a stamp of the database it
+ * was built from (snapshot transaction id, entry count and page count), and a
+ * filter whose stamp does not match the database is ignored.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <lmdb.h>
+
+namespace lmdbtools {
+
+/**
+ * 64-bit MurmurHash64A of a byte string.
+ */
+inline std::uint64_t hash64(const void* const data,
+                            const std::size_t size,
+                            const std::uint64_t seed = 0) noexcept {
+  const std::uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  const unsigned char* const end = p + (size & ~static_cast<std::size_t>(7));
+  std::uint64_t h = seed ^ (size * m);
+  for (; p != end; p += 8) {
+    std::uint64_t k;
+    std::memcpy(&k, p, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  if (size & 7) {
+    for (std::size_t i = size & 7; i-- > 0;) {
+      h ^= static_cast<std::uint64_t>(p[i]) << (8 * i);
+    }
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+/**
+ * Identifies the state of a database a filter was built from.
+ */
+struct filter_stamp {
+  std::uint64_t txnid;
+  std::uint64_t entries;
+  std::uint64_t pages;
+
+  /**
+   * Returns the stamp of the database `dbi` in the snapshot of the
+   * read-only `txn`. A write transaction reports the id it will commit
+   * as, not that of the snapshot it started from.
+   */
+  static filter_stamp of(MDB_txn* const txn,
+                         const MDB_dbi dbi) noexcept {
+    MDB_stat st;
+    if (::mdb_stat(txn, dbi, &st) != MDB_SUCCESS) {
+      return filter_stamp{0, 0, 0};
+    }
+    return filter_stamp{::mdb_txn_id(txn), st.ms_entries,
+                        st.ms_branch_pages + st.ms_leaf_pages
+                        + st.ms_overflow_pages};
+  }
+
+  bool operator==(const filter_stamp& other) const noexcept {
+    return txnid == other.txnid && entries == other.entries
+      && pages == other.pages;
+  }
+};
+
+/**
+ * Cache-line blocked Bloom filter.
+ */
+class bloom_filter {
+  static constexpr std::size_t magic_size = 8;
+  static constexpr std::size_t block_words = 8;  // 512 bits
+  static constexpr std::size_t header_size = 48;
+
+  std::vector<std::uint64_t> _words;
+  std::uint64_t _nblocks{0};
+  std::uint32_t _nprobes{0};
+  filter_stamp _stamp{0, 0, 0};
+
+  template<typename F>
+  void probe(const void* const key,
+             const std::size_t size,
+             F f) const noexcept {
+    const std::uint64_t h = hash64(key, size);
+    const std::uint64_t block = ((h >> 32) * _nblocks) >> 32;
+    const std::uint32_t a = static_cast<std::uint32_t>(h);
+    const std::uint32_t b =
+      static_cast<std::uint32_t>((h * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+    for (std::uint32_t i = 0; i < _nprobes; ++i) {
+      const std::uint32_t bit = (a + i * b) >> 23;  // 0..511
+      f(block * block_words + (bit >> 6), std::uint64_t(1) << (bit & 63));
+    }
+  }
+
+public:
+  bloom_filter() noexcept = default;
+
+  /**
+   * Creates an empty filter sized for `nkeys` keys at `bits_per_key`.
+   */
+  bloom_filter(const std::size_t nkeys,
+               const unsigned bits_per_key) {
+    const std::uint64_t bits = static_cast<std::uint64_t>(nkeys) * bits_per_key;
+    _nblocks = (bits + 511) / 512;
+    if (_nblocks == 0) _nblocks = 1;
+    if (_nblocks > 0xffffffffULL) _nblocks = 0xffffffffULL;
+    _nprobes = static_cast<std::uint32_t>(bits_per_key * 0.69 + 0.5);
+    if (_nprobes < 1) _nprobes = 1;
+    if (_nprobes > 16) _nprobes = 16;
+    _words.assign(_nblocks * block_words, 0);
+  }
+
+  bool empty() const noexcept { return _words.empty(); }
+  std::size_t bytes() const noexcept { return _words.size() * 8; }
+  const filter_stamp& stamp() const noexcept { return _stamp; }
+  void set_stamp(const filter_stamp& stamp) noexcept { _stamp = stamp; }
+
+  void add(const void* const key,
+           const std::size_t size) noexcept {
+    probe(key, size, [this](std::size_t word, std::uint64_t mask) {
+      _words[word] |= mask;
+    });
+  }
+
+  /**
+   * @retval false if the key is certainly not in the database
+   */
+  bool may_contain(const void* const key,
+                   const std::size_t size) const noexcept {
+    bool result = true;
+    probe(key, size, [this, &result](std::size_t word, std::uint64_t mask) {
+      result = result && (_words[word] & mask);
+    });
+    return result;
+  }
+
+  /**
+   * Writes the filter to `path` through a temporary file.
+   *
+   * @retval false on failure, with `errno` set
+   */
+  bool save(const std::string& path) const {
+    const std::string tmppath = path + ".tmp";
+    std::FILE* const fp = std::fopen(tmppath.c_str(), "wb");
+    if (!fp) return false;
+    const std::uint64_t header[header_size / 8 - 1] = {
+      (static_cast<std::uint64_t>(_nprobes) << 32) | 1,  // version 1
+      _stamp.txnid, _stamp.entries, _stamp.pages, _nblocks };
+    bool ok = std::fwrite("LMDBBLM1", magic_size, 1, fp) == 1
+      && std::fwrite(header, sizeof(header), 1, fp) == 1
+      && std::fwrite(_words.data(), 8, _words.size(), fp) == _words.size();
+    ok = (std::fclose(fp) == 0) && ok;
+    if (ok && std::rename(tmppath.c_str(), path.c_str()) == 0) return true;
+    std::remove(tmppath.c_str());
+    return false;
+  }
+
+  /**
+   * Reads the filter stored at `path`.
+   *
+   * @retval false if the file is missing or malformed
+   */
+  bool load(const std::string& path) {
+    std::FILE* const fp = std::fopen(path.c_str(), "rb");
+    if (!fp) return false;
+    char m[magic_size];
+    std::uint64_t header[header_size / 8 - 1];
+    bool ok = std::fread(m, sizeof(m), 1, fp) == 1
+      && std::memcmp(m, "LMDBBLM1", magic_size) == 0
+      && std::fread(header, sizeof(header), 1, fp) == 1
+      && (header[0] & 0xffffffffULL) == 1
+      && header[4] > 0 && header[4] <= 0xffffffffULL;
+    if (ok) {
+      _nprobes = static_cast<std::uint32_t>(header[0] >> 32);
+      _stamp = filter_stamp{header[1], header[2], header[3]};
+      _nblocks = header[4];
+      _words.assign(_nblocks * block_words, 0);
+      ok = std::fread(_words.data(), 8, _words.size(), fp) == _words.size();
+    }
+    std::fclose(fp);
+    if (!ok) _words.clear();
+    return ok;
+  }
+
+  /**
+   * Rewrites the stamp of the filter stored at `path`, e.g. after only
+   * deleting keys, which keeps the filter a superset of the keys.
+   *
+   * @retval false on failure
+   */
+  static bool restamp(const std::string& path,
+                      const filter_stamp& stamp) {
+    std::FILE* const fp = std::fopen(path.c_str(), "r+b");
+    if (!fp) return false;
+    const std::uint64_t s[3] = {stamp.txnid, stamp.entries, stamp.pages};
+    bool ok = std::fseek(fp, magic_size + 8, SEEK_SET) == 0
+      && std::fwrite(s, sizeof(s), 1, fp) == 1;
+    ok = (std::fclose(fp) == 0) && ok;
+    return ok;
+  }
+
+  /**
+   * Returns the sidecar path of the filter of database `dbname`.
+   */
+  static std::string path_of(const std::string& dbname) {
+    return dbname + "-filter";
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_BLOOM_HH
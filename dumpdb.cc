@@ -1,11 +1,407 @@
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <initializer_list>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <regex>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
 #include <libgen.h>
 #include <unistd.h>
 #include "lmdb++.h"
+#include "gzout.hh"
+#include "keyfilter.hh"
+#include "keyschema.hh"
+#include "mdbpage.hh"
+#include "metadata.hh"
+#include "outbuf.hh"
+#include "parallel.hh"
+#include "valcodec.hh"
+
+namespace {
+
+// Settings of the record output.
+struct dump_options {
+  lmdbtools::key_filter filter;  // key pattern
+  lmdbtools::key_filter value_filter;  // value pattern
+  std::string value_literal;  // string values must contain
+  std::string separator;  // field separator
+  bool withkey;  // dump with key
+  bool valkeyorder;  // dump in value-key order
+  lmdbtools::key_schema schema;  // key components; empty: raw keys
+};
+
+// Collects the output of one key range in chunks handed to the ordered
+// output as they fill up.
+class chunk_sink {
+  static constexpr size_t chunk_size = 1UL << 20;
+
+  lmdbtools::ordered_output &_output;
+  const size_t _seq;
+  std::string _chunk;
+
+public:
+  chunk_sink(lmdbtools::ordered_output &output, size_t seq)
+    : _output(output), _seq(seq) {
+    _chunk.reserve(chunk_size);
+  }
+
+  void append(const char *data, size_t size) {
+    _chunk.append(data, size);
+    if (_chunk.size() >= chunk_size) {
+      flush();
+    }
+  }
+
+  void append(const std::string &s) {
+    append(s.data(), s.size());
+  }
+
+  void put(char c) {
+    _chunk += c;
+  }
+
+  void flush() {
+    _output.write(_seq, std::move(_chunk));
+    _chunk = std::string();
+    _chunk.reserve(chunk_size);
+  }
+};
+
+// Tests the value filters on the value bytes in place.
+inline bool value_matches(const lmdb::val &val, const dump_options &opts) {
+  if (!opts.value_literal.empty()
+      && !lmdbtools::find_literal(val.data(), val.size(),
+                                  opts.value_literal.data(),
+                                  opts.value_literal.size())) {
+    return false;
+  }
+  return opts.value_filter(val.data(), val.size());
+}
+
+// Appends a key, as component text if it has a schema.
+template<typename Sink>
+void write_key(const lmdb::val &key, const dump_options &opts, Sink &out) {
+  if (opts.schema.empty()) {
+    out.append(key.data(), key.size());
+  } else {
+    opts.schema.decode(key.data(), key.size(), out);
+  }
+}
+
+// Appends one entry in the configured layout.
+template<typename Sink>
+void write_record(const lmdb::val &key, const lmdb::val &val,
+                  const dump_options &opts, Sink &out) {
+  if (opts.withkey && opts.valkeyorder) {
+    out.append(val.data(), val.size());
+    out.append(opts.separator);
+    write_key(key, opts, out);
+  } else if (opts.withkey && !opts.valkeyorder) {
+    write_key(key, opts, out);
+    out.append(opts.separator);
+    out.append(val.data(), val.size());
+  } else {
+    out.append(val.data(), val.size());
+  }
+  out.put('\n');
+}
+
+// Dumps the entries with keys in [lo, hi) that match the key pattern; an
+// empty bound is unbounded. Only the keys starting with the literal prefix
+// of the pattern are visited, if the key order keeps them together, and
+// only the values of matching keys are decoded.
+template<typename Sink>
+void dump_range(const lmdb::txn &rtxn, const lmdb::dbi &dbi,
+                const lmdbtools::comparator &cmp,
+                lmdbtools::value_codec &codec,
+                const std::string &lo, const std::string &hi,
+                const dump_options &opts, Sink &out) {
+  const lmdbtools::key_filter &filter = opts.filter;
+  auto cursor = lmdb::cursor::open(rtxn, dbi);
+  auto entries = cursor.prefix(cmp.bytewise() ? filter.prefix()
+                                              : std::string());
+  if (!lo.empty()) {
+    entries = entries.from(lo);
+  }
+  if (!hi.empty()) {
+    entries = entries.until(hi);
+  }
+  std::string buf;  // decoded value
+  for (const auto &e : entries) {
+    if (!filter(e.key.data(), e.key.size())) {
+      continue;
+    }
+    const lmdb::val value = codec.decode(e.value, buf);
+    if (!value_matches(value, opts)) {
+      continue;
+    }
+    write_record(e.key, value, opts, out);
+  }
+  cursor.close();
+}
+
+// Dumps each entry matching any of the patterns to the outputs routed from
+// the patterns it matches, once per output.
+void dump_routed(const lmdb::txn &rtxn, const lmdb::dbi &dbi,
+                 const lmdbtools::comparator &cmp,
+                 lmdbtools::value_codec &codec,
+                 const lmdbtools::pattern_set &patterns,
+                 const std::vector<size_t> &routes,
+                 const std::vector<lmdbtools::output_writer *> &outputs,
+                 const dump_options &opts) {
+  auto cursor = lmdb::cursor::open(rtxn, dbi);
+  std::vector<size_t> ids;
+  std::vector<size_t> targets;
+  std::string buf;  // decoded value
+  for (const auto &e : cursor.prefix(cmp.bytewise() ? patterns.prefix()
+                                                     : std::string())) {
+    patterns.match(e.key.data(), e.key.size(), ids);
+    if (ids.empty()) {
+      continue;
+    }
+    const lmdb::val value = codec.decode(e.value, buf);
+    if (!value_matches(value, opts)) {
+      continue;
+    }
+    targets.clear();
+    for (const size_t id : ids) {
+      targets.push_back(routes[id]);
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    for (const size_t t : targets) {
+      write_record(e.key, value, opts, *outputs[t]);
+    }
+  }
+  cursor.close();
+}
+
+// Draws `count` distinct entries uniformly at random and returns their keys
+// in key order. Random descents of the B-tree touch a few pages per entry;
+// a database too small for that, or one whose pages cannot be walked, is
+// sampled by a reservoir over a full cursor pass instead.
+std::vector<std::string> sample_keys(const lmdb::txn &rtxn,
+                                     const lmdb::dbi &dbi, size_t count,
+                                     std::mt19937_64 &rng) {
+  std::vector<std::string> keys;
+  const lmdbtools::mdbpage::tree tree(rtxn, dbi);
+  if (tree.valid() && count <= tree.entries() / 4) {
+    std::vector<unsigned> bounds;
+    std::unordered_set<std::string> seen;
+    MDB_val key;
+    // warm up the page size bounds before drawing
+    for (size_t d = 0; d < 64; ++d) {
+      tree.sample(rng, bounds, key);
+    }
+    const size_t tries = 1000 * (count + 100);
+    for (size_t d = 0; d < tries && keys.size() < count; ++d) {
+      if (!tree.sample(rng, bounds, key)) {
+        continue;
+      }
+      std::string k(static_cast<const char *>(key.mv_data), key.mv_size);
+      if (seen.insert(k).second) {
+        keys.push_back(std::move(k));
+      }
+    }
+    if (keys.size() < count) {
+      keys.clear();
+    }
+  }
+  if (keys.empty()) {
+    auto cursor = lmdb::cursor::open(rtxn, dbi);
+    size_t n = 0;
+    for (const auto &e : cursor.range()) {
+      if (n < count) {
+        keys.emplace_back(e.key.data(), e.key.size());
+      } else {
+        const size_t r = std::uniform_int_distribution<size_t>(0, n)(rng);
+        if (r < count) {
+          keys[r].assign(e.key.data(), e.key.size());
+        }
+      }
+      ++n;
+    }
+    cursor.close();
+  }
+  std::sort(keys.begin(), keys.end(),
+            [&](const std::string &a, const std::string &b) {
+    const lmdb::val x{a.data(), a.size()};
+    const lmdb::val y{b.data(), b.size()};
+    return mdb_cmp(rtxn, dbi, x, y) < 0;
+  });
+  return keys;
+}
+
+// Dumps the sampled entries that match the filters and returns how many
+// matched.
+template<typename Sink>
+size_t dump_sample(const lmdb::txn &rtxn, const lmdb::dbi &dbi,
+                   lmdbtools::value_codec &codec,
+                   const std::vector<std::string> &keys,
+                   const dump_options &opts, Sink *out) {
+  size_t matched = 0;
+  auto cursor = lmdb::cursor::open(rtxn, dbi);
+  lmdb::val val;
+  std::string buf;  // decoded value
+  for (const auto &k : keys) {
+    lmdb::val key{k.data(), k.size()};
+    if (!cursor.get(key, val, MDB_SET_KEY)) {
+      continue;
+    }
+    if (!opts.filter(key.data(), key.size())) {
+      continue;
+    }
+    const lmdb::val value = codec.decode(val, buf);
+    if (!value_matches(value, opts)) {
+      continue;
+    }
+    ++matched;
+    if (out) {
+      write_record(key, value, opts, *out);
+    }
+  }
+  cursor.close();
+  return matched;
+}
+
+// Writes statistics of a database as "<dbname> <name> <value>" lines.
+// Histogram lines hold the lower bound of a power-of-two size bucket and
+// its count, and for values also the overflow pages of the bucket.
+template<typename Sink>
+void dump_stats(const std::string &dbname, MDB_env *env,
+                const lmdb::txn &rtxn, const lmdb::dbi &dbi,
+                bool histograms, const std::string &separator, Sink &out) {
+  auto line = [&](std::initializer_list<std::string> fields) {
+    out.append(dbname);
+    for (const auto &field : fields) {
+      out.append(separator);
+      out.append(field);
+    }
+    out.put('\n');
+  };
+  auto ratio = [](double x) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.4f", x);
+    return std::string(buf);
+  };
+  using std::to_string;
+
+  const MDB_stat st = dbi.stat(rtxn);
+  MDB_envinfo info;
+  lmdb::env_info(env, &info);
+  const size_t pages = st.ms_branch_pages + st.ms_leaf_pages
+    + st.ms_overflow_pages;
+  line({"entries", to_string(st.ms_entries)});
+  line({"psize", to_string(st.ms_psize)});
+  line({"depth", to_string(st.ms_depth)});
+  line({"branch_pages", to_string(st.ms_branch_pages)});
+  line({"leaf_pages", to_string(st.ms_leaf_pages)});
+  line({"overflow_pages", to_string(st.ms_overflow_pages)});
+  line({"overflow_ratio",
+        ratio(pages ? double(st.ms_overflow_pages) / pages : 0.0)});
+  line({"map_size", to_string(info.me_mapsize)});
+  line({"map_used", to_string((info.me_last_pgno + 1) * st.ms_psize)});
+  line({"last_pgno", to_string(info.me_last_pgno)});
+  line({"last_txnid", to_string(info.me_last_txnid)});
+  line({"max_readers", to_string(info.me_maxreaders)});
+  line({"num_readers", to_string(info.me_numreaders)});
+
+  // each record of the free list (FREE_DBI) holds a page number list
+  // whose first word is its length
+  size_t free_entries = 0;
+  size_t free_pages = 0;
+  auto freelist = lmdb::cursor::open(rtxn, 0);
+  for (const auto &e : freelist.range()) {
+    ++free_entries;
+    if (e.value.size() >= sizeof(size_t)) {
+      size_t n;
+      std::memcpy(&n, e.value.data(), sizeof(n));
+      free_pages += n;
+    }
+  }
+  freelist.close();
+  line({"free_entries", to_string(free_entries)});
+  line({"free_pages", to_string(free_pages)});
+
+  if (!histograms) {
+    return;
+  }
+
+  // fill factor of branch and leaf pages from a walk over the tree
+  size_t used[2] = {0, 0};
+  size_t walked[2] = {0, 0};
+  const lmdbtools::mdbpage::tree tree(rtxn, dbi);
+  const bool walked_all = tree.walk([&](const char *page, unsigned) {
+    const int leaf = lmdbtools::mdbpage::is_leaf(page) ? 1 : 0;
+    used[leaf] += tree.psize() - (lmdbtools::mdbpage::page_upper(page)
+                                  - lmdbtools::mdbpage::page_lower(page));
+    ++walked[leaf];
+  });
+  if (walked_all) {
+    line({"branch_fill", ratio(walked[0] ? double(used[0])
+                               / (walked[0] * tree.psize()) : 0.0)});
+    line({"leaf_fill", ratio(walked[1] ? double(used[1])
+                             / (walked[1] * tree.psize()) : 0.0)});
+  }
+
+  // key and value size histograms from a cursor pass
+  auto bucket = [](size_t size) {
+    size_t b = 0;
+    while (size > 0) {
+      size >>= 1;
+      ++b;
+    }
+    return b;  // 0: size 0, b: [2^(b-1), 2^b)
+  };
+  std::vector<size_t> keys(65, 0);
+  std::vector<size_t> values(65, 0);
+  std::vector<size_t> value_pages(65, 0);
+  size_t big_values = 0;
+  auto cursor = lmdb::cursor::open(rtxn, dbi);
+  for (const auto &e : cursor.range()) {
+    ++keys[bucket(e.key.size())];
+    const size_t b = bucket(e.value.size());
+    ++values[b];
+    if (lmdbtools::mdbpage::is_big(st.ms_psize, e.key.size(),
+                                   e.value.size())) {
+      ++big_values;
+      value_pages[b] += lmdbtools::mdbpage::value_pages(st.ms_psize,
+                                                        e.value.size());
+    }
+  }
+  cursor.close();
+  line({"big_values", to_string(big_values)});
+  for (size_t b = 0; b < keys.size(); ++b) {
+    if (keys[b]) {
+      line({"key_size", to_string(b ? size_t(1) << (b - 1) : 0),
+            to_string(keys[b])});
+    }
+  }
+  for (size_t b = 0; b < values.size(); ++b) {
+    if (values[b]) {
+      line({"value_size", to_string(b ? size_t(1) << (b - 1) : 0),
+            to_string(values[b]), to_string(value_pages[b])});
+    }
+  }
+}
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
   using namespace std;
@@ -13,30 +409,90 @@ int main(int argc, char *argv[]) {
   int verbose = 0;  // verbose output
   string separator = "\t";  // field separator
   string pattern = "";  // regular expression pattern
+  string patternfile = "";  // file of patterns and their output files
+  string valpattern = "";  // regular expression pattern for value
+  string valliteral = "";  // string values must contain
   bool stat = false;  // dump database statistics only
+  int stats = 0;  // dump detailed statistics; 2: with histograms
   bool withkey = true;  // dump with hash key
   bool valkeyorder = false;  // dump database in value-key order
+  bool splice = false;  // vmsplice large values into an output pipe
+  unsigned int nthreads = 1;  // number of dump threads
+  const int max_threads = 1024;  // bound of -j
+  int gzlevel = 0;  // gzip compression level of the output
+  size_t samplesize = 0;  // number of entries sampled at random
+  uint64_t seed = random_device()();  // random seed of the sampling
+  const size_t outlimit = 64UL << 20;  // output buffered out of order
+  lmdbtools::key_schema schema;  // key components
 
   string progname = basename(argv[0]);
   string usage = "usage: " + progname +
     " [options] <dbname> [...]\n"
     "options: -p <regex>  regular expression pattern for key\n"
-    "         -n          dump database statistics only\n"
+    "         -V <regex>  regular expression pattern for value\n"
+    "         -C <str>    dump only entries whose value contains a string\n"
+    "         -f <file>   dump the keys matching each pattern of a file of\n"
+    "                     <regex> TAB <outfile> lines to its output file\n"
+    "                     (\"-\" for stdout) in a single scan\n"
+    "         -n          dump database statistics only; with -S, the\n"
+    "                     estimated number of entries matching the\n"
+    "                     filters and its 95% margin of error\n"
+    "         -N          dump detailed statistics as <dbname> <name>\n"
+    "                     <value> lines: MDB_stat, mdb_env_info and the\n"
+    "                     free list\n"
+    "         -H          with -N, add page fill factors and key and value\n"
+    "                     size histograms: <dbname> key_size <lower bound>\n"
+    "                     <count>, <dbname> value_size <lower bound> <count>\n"
+    "                     <overflow pages>\n"
     "         -K          dump values only without keys\n"
     "         -r          dump database in value-key reverse order\n"
     "         -s <str>    field separator\n"
-    "         -v          verbose output\n"
+    "         -j <num>    number of dump threads (1), at most "
+    + to_string(max_threads) + "; 0: all\n"
+    "                     cores; key ranges split at branch page keys are\n"
+    "                     dumped in parallel and output in key order; with\n"
+    "                     -n or -N the databases are surveyed in parallel\n"
+    "                     and output in argument order\n"
+    "         -P          vmsplice large values into an output pipe; the\n"
+    "                     databases must not be written meanwhile, nor\n"
+    "                     have compressed or out-of-line values\n"
+    "         -S <num>    dump the entries matching the filters among <num>\n"
+    "                     entries sampled uniformly at random, in key order\n"
+    "         -R <seed>   random seed of the sampling\n"
+    "         -z <level>  gzip compress the output at level 1-9, in blocks\n"
+    "                     deflated in parallel on all cores\n"
+    "         -t <schema> dump keys stored by makedb -t <schema> as comma\n"
+    "                     separated components\n"
+    "         -v          verbose output"
+    + string(lmdb::instrument::enabled
+             ? "; -vv adds lmdb call statistics\n" : "\n")
     ;
   for (opterr = 0;;) {
-    int opt = getopt(argc, argv, ":nKrs:p:v");
+    int opt = getopt(argc, argv, ":nNHKrs:j:Pz:S:R:t:p:V:C:f:v");
     if (opt == -1) break;
     try {
       switch (opt) {
         case 'p': { pattern = optarg; break; }
+        case 'V': { valpattern = optarg; break; }
+        case 'C': { valliteral = optarg; break; }
+        case 'f': { patternfile = optarg; break; }
         case 'n': { stat = true; break; }
+        case 'N': { stats = max(stats, 1); break; }
+        case 'H': { stats = 2; break; }
         case 'K': { withkey = false; break; }
         case 'r': { valkeyorder = true; break; }
         case 's': { separator = optarg; break; }
+        case 'j': { const int n = stoi(optarg);
+                    if (n < 0 || n > max_threads) throw 0;
+                    nthreads = n;
+                    break; }
+        case 'P': { splice = true; break; }
+        case 'z': { gzlevel = stoi(optarg);
+                    if (gzlevel < 1 || gzlevel > 9) throw 0;
+                    break; }
+        case 'S': { samplesize = stoul(optarg); break; }
+        case 'R': { seed = stoull(optarg); break; }
+        case 't': { schema = lmdbtools::key_schema(optarg); break; }
         case 'v': { ++verbose; break; }
         case ':': { cout << "missing argument of -"
                     << static_cast<char>(optopt) << endl;
@@ -58,83 +514,301 @@ int main(int argc, char *argv[]) {
     cout << "too few arguments\n" << usage << flush;
     exit(EXIT_FAILURE);
   }
+  if (verbose > 1) {
+    lmdb::instrument::print_at_exit();
+  }
+  if (!patternfile.empty()
+      && (!pattern.empty() || nthreads != 1 || samplesize > 0)) {
+    cout << "-f cannot be combined with -p, -j or -S\n" << usage << flush;
+    exit(EXIT_FAILURE);
+  }
+  if (!schema.empty() && (!pattern.empty() || !patternfile.empty())) {
+    cout << "-t cannot be combined with -p or -f\n" << usage << flush;
+    exit(EXIT_FAILURE);
+  }
+  if (nthreads == 0) {
+    nthreads = max(1U, thread::hardware_concurrency());
+  }
 
-  cout.sync_with_stdio(false);
+  auto open_writer = [gzlevel](int fd) -> lmdbtools::output_writer * {
+    if (gzlevel > 0) {
+      return new lmdbtools::gzip_writer(fd, gzlevel,
+                                        thread::hardware_concurrency());
+    }
+    return new lmdbtools::output_writer(fd);
+  };
+  unique_ptr<lmdbtools::output_writer> stdout_writer(
+      open_writer(STDOUT_FILENO));
+  lmdbtools::output_writer &out = *stdout_writer;
   try {
+    // a pipe must not refer to decoded values, which live in a buffer
+    // reused for the next one
+    if (splice && none_of(argv + optind, argv + argc, [](const char *db) {
+          return lmdbtools::value_codec::of(db).active();
+        })) {
+      out.enable_splice();
+    }
+    auto compile = [](const string &p) {
+      try {
+        return lmdbtools::key_filter(p);
+      }
+      catch (const regex_error &e) {
+        throw runtime_error(string(e.what()) + ": pattern: " + p);
+      }
+    };
+    const dump_options opts{compile(pattern), compile(valpattern), valliteral,
+                            separator, withkey, valkeyorder, schema};
+    if (verbose > 0 && opts.filter.active()) {
+      cerr << "pattern: " << pattern << endl;
+      cerr << "prefix: " << opts.filter.prefix() << endl;
+      for (const auto &literal : opts.filter.literals()) {
+        cerr << "literal: " << literal << endl;
+      }
+    }
+
+    // patterns of the pattern file and the outputs they are routed to
+    lmdbtools::pattern_set patterns;
+    vector<size_t> routes;
+    vector<lmdbtools::output_writer *> outputs;
+    vector<unique_ptr<lmdbtools::output_writer>> files;
+    vector<int> fds;
+    if (!patternfile.empty()) {
+      map<string, size_t> destinations;
+      for (const auto &route : lmdbtools::read_routes(patternfile)) {
+        try {
+          patterns.add(route.first);
+        }
+        catch (const regex_error &e) {
+          throw runtime_error(patternfile + ": " + e.what() + ": pattern: "
+                              + route.first);
+        }
+        auto it = destinations.find(route.second);
+        if (it == destinations.end()) {
+          if (route.second == "-") {
+            outputs.push_back(&out);
+          } else {
+            const int fd = open(route.second.c_str(),
+                                O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0) {
+              throw system_error(errno, system_category(), route.second);
+            }
+            fds.push_back(fd);
+            files.emplace_back(open_writer(fd));
+            outputs.push_back(files.back().get());
+          }
+          it = destinations.emplace(route.second, outputs.size() - 1).first;
+        }
+        routes.push_back(it->second);
+      }
+      patterns.build();
+      if (verbose > 0) {
+        cerr << "patterns: " << patterns.size() << " outputs: "
+          << outputs.size() << " prefix: " << patterns.prefix() << endl;
+      }
+    }
+
+    if (stat || stats > 0) {
+      // each database is opened and stat'ed on its own; with several
+      // threads they are surveyed concurrently and printed in argument
+      // order
+      auto survey = [&](size_t d, auto &sink) {
+        const char *dbname = argv[optind + d];
+        auto env = lmdb::env::create();
+        env.set_mapsize(0);
+        env.open(dbname, MDB_NOSUBDIR | MDB_NOTLS | MDB_NOLOCK | MDB_RDONLY);
+        auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+        auto dbi  = lmdb::dbi::open(rtxn);
+        lmdbtools::comparator::of(dbname).apply(rtxn, dbi);
+        if (stat && samplesize > 0) {
+          auto codec = lmdbtools::value_codec::of(dbname);
+          // the share of matching entries in the sample, scaled to the
+          // database, with the normal approximation of its error
+          mt19937_64 rng(seed + d);
+          const double entries = dbi.stat(rtxn).ms_entries;
+          const auto keys = sample_keys(rtxn, dbi, samplesize, rng);
+          const double n = keys.size();
+          const double p = n > 0 ? dump_sample<chunk_sink>(
+              rtxn, dbi, codec, keys, opts, nullptr) / n : 0.0;
+          const double fpc = entries > 1 ? (entries - n) / (entries - 1) : 0.0;
+          const double margin = n > 0
+            ? 1.96 * sqrt(p * (1 - p) / n * fpc) * entries : 0.0;
+          sink.append(dbname, strlen(dbname));
+          sink.append(separator);
+          sink.append(to_string(llround(p * entries)));
+          sink.append(separator);
+          sink.append(to_string(llround(margin)));
+          sink.put('\n');
+        } else if (stat) {
+          auto st   = dbi.stat(rtxn);
+          sink.append(dbname, strlen(dbname));
+          sink.append(separator);
+          sink.append(to_string(st.ms_entries));
+          sink.put('\n');
+        } else {
+          dump_stats(dbname, env, rtxn, dbi, stats > 1, separator, sink);
+        }
+        rtxn.abort();
+      };
+
+      const size_t ndbs = argc - optind;
+      if (nthreads == 1 || ndbs == 1) {
+        for (size_t d = 0; d < ndbs; ++d) {
+          if (verbose > 0) {
+            cerr << argv[optind + d] << endl;
+          }
+          survey(d, out);
+        }
+        out.flush();
+        return EXIT_SUCCESS;
+      }
+
+      mutex failure_mutex;
+      exception_ptr failure;
+      auto fail = [&]() {
+        lock_guard<mutex> lock(failure_mutex);
+        if (!failure) failure = current_exception();
+      };
+      bool broken = false;
+      lmdbtools::ordered_output output(
+          [&](const string &s) {
+            if (broken) return;
+            try {
+              out.append(s);
+            }
+            catch (...) { fail(); broken = true; }
+          }, outlimit);
+      output.close(ndbs);
+
+      atomic<size_t> next{0};
+      vector<thread> workers;
+      for (unsigned int t = 0; t < min<size_t>(nthreads, ndbs); ++t) {
+        workers.emplace_back([&]() {
+          for (size_t d; (d = next++) < ndbs;) {
+            try {
+              chunk_sink sink(output, d);
+              survey(d, sink);
+              sink.flush();
+            }
+            catch (...) { fail(); }
+            output.done(d);
+          }
+        });
+      }
+      output.run();
+      for (auto &w : workers) w.join();
+      if (failure) rethrow_exception(failure);
+      out.flush();
+      return EXIT_SUCCESS;
+    }
+
     for (int i = optind; i < argc; ++i) {
       if (verbose > 0) {
         cerr << argv[i] << endl;
       }
       auto env = lmdb::env::create();
       env.set_mapsize(0);
-      env.open(argv[i], MDB_NOSUBDIR | MDB_NOLOCK | MDB_RDONLY);
+      env.open(argv[i], MDB_NOSUBDIR | MDB_NOTLS | MDB_NOLOCK | MDB_RDONLY);
 
+      const auto cmp = lmdbtools::comparator::of(argv[i]);
+      auto codec = lmdbtools::value_codec::of(argv[i]);
       auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
       auto dbi  = lmdb::dbi::open(rtxn);
+      cmp.apply(rtxn, dbi);
 
-      if (stat) {
-        auto st   = dbi.stat(rtxn);
-        cout << argv[i] << separator << st.ms_entries << '\n';
-      } else {
-        auto cursor = lmdb::cursor::open(rtxn, dbi);
-        lmdb::val key;
-        lmdb::val val;
-
-        if (pattern.empty()) {
-          if (withkey && valkeyorder) {
-            while (cursor.get(key, val, MDB_NEXT)) {
-              const string keystr(key.data(), key.size());
-              const string valstr(val.data(), val.size());
-              cout << valstr << separator << keystr << '\n';
-            }
-          } else if (withkey && !valkeyorder) {
-            while (cursor.get(key, val, MDB_NEXT)) {
-              const string keystr(key.data(), key.size());
-              const string valstr(val.data(), val.size());
-              cout << keystr << separator << valstr << '\n';
-            }
-          } else {
-            while (cursor.get(key, val, MDB_NEXT)) {
-              const string valstr(val.data(), val.size());
-              cout << valstr << '\n';
-            }
-          }
-        } else {
-          const regex pat(pattern);
-          if (withkey && valkeyorder) {
-            while (cursor.get(key, val, MDB_NEXT)) {
-              const string keystr(key.data(), key.size());
-              const string valstr(val.data(), val.size());
-              if (regex_search(keystr, pat)) {
-                cout << valstr << separator << keystr << '\n';
-              }
-            }
-          } else if (withkey && !valkeyorder) {
-            while (cursor.get(key, val, MDB_NEXT)) {
-              const string keystr(key.data(), key.size());
-              const string valstr(val.data(), val.size());
-              if (regex_search(keystr, pat)) {
-                cout << keystr << separator << valstr << '\n';
-              }
+      if (!patternfile.empty()) {
+        dump_routed(rtxn, dbi, cmp, codec, patterns, routes, outputs, opts);
+        rtxn.abort();
+        continue;
+      }
+      if (samplesize > 0) {
+        mt19937_64 rng(seed + (i - optind));
+        const auto keys = sample_keys(rtxn, dbi, samplesize, rng);
+        if (verbose > 0) {
+          cerr << "sampled: " << keys.size() << endl;
+        }
+        dump_sample(rtxn, dbi, codec, keys, opts, &out);
+        rtxn.abort();
+        continue;
+      }
+
+      // a few ranges per thread even out their differing sizes
+      vector<string> seps;
+      if (nthreads > 1) {
+        seps = lmdbtools::mdbpage::tree(rtxn, dbi).separators(4 * nthreads - 1);
+      }
+      if (verbose > 0 && nthreads > 1) {
+        cerr << "ranges: " << seps.size() + 1 << endl;
+      }
+      if (seps.empty()) {
+        dump_range(rtxn, dbi, cmp, codec, string(), string(), opts, out);
+        rtxn.abort();
+        continue;
+      }
+      rtxn.abort();
+
+      // dump each range on a worker thread with its own read-only
+      // transaction and write the ranges out in key order
+      const size_t nranges = seps.size() + 1;
+      mutex failure_mutex;
+      exception_ptr failure;
+      auto fail = [&]() {
+        lock_guard<mutex> lock(failure_mutex);
+        if (!failure) failure = current_exception();
+      };
+
+      // a failed write drops the rest of the output so that the workers
+      // still drain
+      bool broken = false;
+      lmdbtools::ordered_output output(
+          [&](const string &s) {
+            if (broken) return;
+            try {
+              out.append(s);
             }
-          } else {
-            while (cursor.get(key, val, MDB_NEXT)) {
-              const string keystr(key.data(), key.size());
-              const string valstr(val.data(), val.size());
-              if (regex_search(keystr, pat)) {
-                cout << valstr << '\n';
-              }
+            catch (...) { fail(); broken = true; }
+          }, outlimit);
+      output.close(nranges);
+
+      atomic<size_t> next{0};
+      vector<thread> workers;
+      for (unsigned int t = 0; t < min<size_t>(nthreads, nranges); ++t) {
+        workers.emplace_back([&]() {
+          auto worker_codec = codec;  // streams of its own
+          for (size_t r; (r = next++) < nranges;) {
+            try {
+              auto txn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+              chunk_sink sink(output, r);
+              dump_range(txn, dbi, cmp, worker_codec,
+                         r > 0 ? seps[r - 1] : string(),
+                         r + 1 < nranges ? seps[r] : string(), opts, sink);
+              sink.flush();
             }
+            catch (...) { fail(); }
+            output.done(r);
           }
-        }
-        cout << flush;
-        cursor.close();
+        });
+      }
+      output.run();
+      for (auto &w : workers) w.join();
+      if (failure) rethrow_exception(failure);
+    }
+    out.flush();
+    for (size_t f = 0; f < files.size(); ++f) {
+      files[f]->flush();
+      if (close(fds[f]) != 0) {
+        throw system_error(errno, system_category(), "close");
       }
-      rtxn.abort();
     }
   }
   catch (const lmdb::error &e) {
-    cout << flush;
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (const system_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (const runtime_error &e) {
     cerr << e.what() << endl;
     return EXIT_FAILURE;
   }
@@ -0,0 +1,106 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <libgen.h>
+#include <unistd.h>
+#include "lmdb++.h"
+#include "bloom.hh"
+#include "metadata.hh"
+
+int main(int argc, char *argv[]) {
+  using namespace std;
+
+  uint64_t mapsize = 1024UL * 1024UL;  // lmdb map size in MiB
+  unsigned bitsperkey = 10;  // filter bits per key
+  int verbose = 0;  // verbose output
+
+  string progname = basename(argv[0]);
+  string usage = "usage: " + progname +
+    " [options] <dbname> [<dbname> ...]\n"
+    "builds the negative-lookup filter <dbname>-filter of each database\n"
+    "options: -b <bits>  filter bits per key (" + to_string(bitsperkey) + ")\n"
+    "         -m <size>  lmdb map size in MiB (" + to_string(mapsize) + ")\n"
+    "         -v         verbose output"
+    + string(lmdb::instrument::enabled
+             ? "; -vv adds lmdb call statistics\n" : "\n")
+    ;
+  for (opterr = 0;;) {
+    int opt = getopt(argc, argv, ":b:m:v");
+    if (opt == -1) break;
+    try {
+      switch (opt) {
+        case 'b': { bitsperkey = stoul(optarg);
+                    if (bitsperkey < 1 || bitsperkey > 64) throw 0;
+                    break; }
+        case 'm': { mapsize = stoul(optarg); break; }
+        case 'v': { ++verbose; break; }
+        case ':': { cout << "missing argument of -"
+                    << static_cast<char>(optopt) << endl;
+                    exit(EXIT_FAILURE);
+                  }
+        case '?':
+        default:  { cout << "unknown option -"
+                    << static_cast<char>(optopt) << '\n' << usage << flush;
+                    exit(EXIT_FAILURE);
+                  }
+      }
+    }
+    catch (...) {
+      cout << "invalid argument: " << argv[optind - 1] << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (argc - optind < 1) {
+    cout << "too few arguments\n" << usage << flush;
+    exit(EXIT_FAILURE);
+  }
+  if (verbose > 1) {
+    lmdb::instrument::print_at_exit();
+  }
+
+  try {
+    for (int i = optind; i < argc; ++i) {
+      const string dbfname(argv[i]);
+      const string filterfname = lmdbtools::bloom_filter::path_of(dbfname);
+      if (verbose > 0) {
+        cerr << dbfname << endl;
+      }
+      auto env = lmdb::env::create();
+      env.set_mapsize(mapsize * 1024UL * 1024UL);
+      env.open(dbfname.c_str(), MDB_NOSUBDIR | MDB_NOLOCK | MDB_RDONLY);
+
+      auto rtxn   = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+      auto dbi    = lmdb::dbi::open(rtxn);
+      lmdbtools::comparator::of(dbfname).apply(rtxn, dbi);
+      const auto stamp = lmdbtools::filter_stamp::of(rtxn, dbi);
+
+      lmdbtools::bloom_filter filter(stamp.entries, bitsperkey);
+      filter.set_stamp(stamp);
+      auto cursor = lmdb::cursor::open(rtxn, dbi);
+      for (const auto &e : cursor.range()) {
+        filter.add(e.key.data(), e.key.size());
+      }
+      cursor.close();
+      rtxn.abort();
+
+      if (!filter.save(filterfname)) {
+        cerr << filterfname << ": " << strerror(errno) << endl;
+        return EXIT_FAILURE;
+      }
+      cout << filterfname << '\t' << stamp.entries << '\t'
+        << filter.bytes() << endl;
+    }
+  }
+  catch (const lmdb::error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+#ifndef LMDBTOOLS_GZOUT_HH
+#define LMDBTOOLS_GZOUT_HH
+
+/**
+ * Buffered writer of gzip compressed output.
+ *
+ * The buffered output is cut into blocks, which a pool of worker threads
+ * deflates into gzip members of their own while the caller keeps filling
+ * the next block. The members go out in block order; their concatenation
+ * is a valid gzip stream (RFC 1952) that gunzip and zcat read as a whole.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+#include "outbuf.hh"
+#include "parallel.hh"
+
+namespace lmdbtools {
+
+class gzip_writer : public output_writer {
+  using job = std::pair<std::size_t, std::string>;
+
+  const int _level;
+  const std::size_t _block_size;
+  std::size_t _next{0};
+  std::size_t _emitted{0};
+  std::exception_ptr _failure;
+  std::mutex _mutex;
+  std::condition_variable _progress;
+  work_queue<job> _queue;
+  ordered_output _output;
+  std::vector<std::thread> _workers;
+  std::thread _emitter;
+
+  void fail() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_failure) _failure = std::current_exception();
+    _progress.notify_all();
+  }
+
+  bool failed() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return static_cast<bool>(_failure);
+  }
+
+  void check() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failure) std::rethrow_exception(_failure);
+  }
+
+  static std::string compress(z_stream& zs,
+                              const std::string& block) {
+    if (::deflateReset(&zs) != Z_OK) {
+      throw std::runtime_error("deflateReset: failed");
+    }
+    std::string member(::deflateBound(&zs, block.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(block.data()));
+    zs.avail_in = static_cast<uInt>(block.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&member[0]);
+    zs.avail_out = static_cast<uInt>(member.size());
+    if (::deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+      throw std::runtime_error(std::string("deflate: ")
+                               + (zs.msg ? zs.msg : "failed"));
+    }
+    member.resize(member.size() - zs.avail_out);
+    return member;
+  }
+
+  void work() {
+    z_stream zs{};
+    bool ready = false;
+    try {
+      // window bits beyond 15 select the gzip wrapper
+      if (::deflateInit2(&zs, _level, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("deflateInit2: failed");
+      }
+      ready = true;
+    }
+    catch (...) { fail(); }
+    job j;
+    while (_queue.pop(j)) {
+      try {
+        if (ready && !failed()) {
+          _output.write(j.first, compress(zs, j.second));
+        }
+      }
+      catch (...) { fail(); }
+      _output.done(j.first);
+    }
+    if (ready) ::deflateEnd(&zs);
+  }
+
+  void emit(const std::string& member) {
+    if (!failed()) {
+      try {
+        struct iovec iov{const_cast<char*>(member.data()), member.size()};
+        write_all(&iov, 1);
+      }
+      catch (...) { fail(); }
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_emitted;
+    _progress.notify_all();
+  }
+
+  void stop() noexcept {
+    _queue.close();
+    for (auto& w : _workers) w.join();
+    _output.close(_next);
+    if (_emitter.joinable()) _emitter.join();
+  }
+
+protected:
+  void drain(struct iovec* iov,
+             int iovcnt) override {
+    check();
+    std::string block;
+    for (; iovcnt > 0; ++iov, --iovcnt) {
+      const char* data = static_cast<const char*>(iov->iov_base);
+      std::size_t size = iov->iov_len;
+      while (size > 0) {
+        if (block.empty()) block.reserve(_block_size);
+        const std::size_t n = std::min(size, _block_size - block.size());
+        block.append(data, n);
+        data += n;
+        size -= n;
+        if (block.size() == _block_size) {
+          _queue.push(job{_next++, std::move(block)});
+          block.clear();
+        }
+      }
+    }
+    if (!block.empty()) {
+      _queue.push(job{_next++, std::move(block)});
+    }
+  }
+
+  /**
+   * Waits until the members of all blocks drained so far are written. An
+   * empty output still gets one empty member to form a valid gzip stream.
+   */
+  void settle() override {
+    if (_next == 0) {
+      _queue.push(job{_next++, std::string()});
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _progress.wait(lock, [this] { return _failure || _emitted == _next; });
+    if (_failure) std::rethrow_exception(_failure);
+  }
+
+public:
+  /**
+   * @param level    compression level from 1 (fastest) to 9 (smallest)
+   * @param threads  number of compressing threads
+   */
+  gzip_writer(const int fd,
+              const int level,
+              const unsigned int threads,
+              const std::size_t capacity = default_capacity)
+    : output_writer{fd, capacity},
+      _level{level},
+      _block_size{capacity < 4096 ? 4096 : capacity},
+      _queue{2 * std::max(threads, 1U)},
+      _output{[this](const std::string& member) { emit(member); },
+              2 * std::max(threads, 1U) * _block_size} {
+    try {
+      for (unsigned int t = 0; t < std::max(threads, 1U); ++t) {
+        _workers.emplace_back([this] { work(); });
+      }
+      _emitter = std::thread([this] { _output.run(); });
+    }
+    catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  /**
+   * Writes the remaining output, ignoring errors.
+   */
+  ~gzip_writer() noexcept override {
+    try {
+      flush();
+    }
+    catch (...) {}
+    stop();
+  }
+
+  /**
+   * Compressed output is never spliced.
+   */
+  bool enable_splice() noexcept override {
+    return false;
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_GZOUT_HH
@@ -0,0 +1,453 @@
+#ifndef LMDBTOOLS_KEYFILTER_HH
+#define LMDBTOOLS_KEYFILTER_HH
+
+/**
+ * Regular expression key filter with literal prefiltering.
+ *
+ * The pattern (ECMAScript syntax) is analyzed once for literal text every
+ * match must contain: an anchored literal prefix, which lets a scan seek
+ * to the first candidate key with `MDB_SET_RANGE` and stop after the last
+ * one, and literal substrings, which are searched for with SSE2 before the
+ * regular expression runs. The analysis is conservative: anything it does
+ * not understand, such as a group or a top-level alternation, simply
+ * contributes no literals.
+ *
+ * Many patterns are matched together by `pattern_set`, which runs one
+ * Aho-Corasick automaton over a key to find the patterns whose literals
+ * occur in it, and verifies only those.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace lmdbtools {
+
+/**
+ * Returns the first occurrence of `needle` in `haystack`, or `nullptr`.
+ *
+ * Candidate positions are those where both the first and the last byte of
+ * the needle match, tested 16 at a time; only they are compared in full.
+ */
+inline const char* find_literal(const char* const haystack,
+                                const std::size_t size,
+                                const char* const needle,
+                                const std::size_t length) noexcept {
+  if (length == 0) return haystack;
+  if (length > size) return nullptr;
+  std::size_t i = 0;
+#ifdef __SSE2__
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[length - 1]);
+  for (; i + length - 1 + 16 <= size; i += 16) {
+    const __m128i a = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(haystack + i));
+    const __m128i b = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(haystack + i + length - 1));
+    unsigned mask = _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask != 0) {
+      const unsigned bit = __builtin_ctz(mask);
+      if (std::memcmp(haystack + i + bit + 1, needle + 1, length - 1) == 0) {
+        return haystack + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i + length <= size; ++i) {
+    if (haystack[i] == needle[0]
+        && std::memcmp(haystack + i + 1, needle + 1, length - 1) == 0) {
+      return haystack + i;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Key filter of a regular expression searched for in keys. It applies to
+ * values just as well, minus the prefix seek.
+ */
+class key_filter {
+  std::regex _pat;
+  bool _active{false};  // a pattern was given
+  bool _needs_regex{false};  // the literals alone do not decide a match
+  std::string _prefix;  // literal prefix of every match
+  std::vector<std::string> _literals;  // literals every match contains
+
+  static std::size_t skip_class(const std::string& p,
+                                std::size_t i) noexcept {
+    for (++i; i < p.size() && p[i] != ']'; ++i) {
+      if (p[i] == '\\') ++i;
+    }
+    return i;
+  }
+
+  static std::size_t skip_group(const std::string& p,
+                                std::size_t i) noexcept {
+    unsigned depth = 0;
+    for (; i < p.size(); ++i) {
+      if (p[i] == '\\') {
+        ++i;
+      } else if (p[i] == '[') {
+        i = skip_class(p, i);
+      } else if (p[i] == '(') {
+        ++depth;
+      } else if (p[i] == ')' && --depth == 0) {
+        break;
+      }
+    }
+    return i;
+  }
+
+  /**
+   * Collects the literal prefix the pattern is anchored with and the runs
+   * of literal characters every match contains, and tells whether these
+   * make up the whole pattern.
+   */
+  void analyze(const std::string& p) {
+    for (std::size_t i = 0; i < p.size(); ++i) {
+      if (p[i] == '\\') {
+        ++i;
+      } else if (p[i] == '[') {
+        i = skip_class(p, i);
+      } else if (p[i] == '(') {
+        i = skip_group(p, i);  // groups contribute no literals anyway
+      } else if (p[i] == '|') {  // alternation: no literals
+        _needs_regex = true;
+        return;
+      }
+    }
+    std::vector<std::string> runs{std::string()};
+    bool prefix_open = !p.empty() && p[0] == '^';
+    bool whole = true;  // only literal characters so far
+    bool atom_literal = false;  // the last atom was a literal character
+    auto cut = [&]() {
+      if (!runs.back().empty()) runs.emplace_back();
+      prefix_open = false;
+      whole = false;
+    };
+    for (std::size_t i = prefix_open ? 1 : 0; i < p.size(); ++i) {
+      const char c = p[i];
+      if (c == '*' || c == '?' || c == '+' || c == '{') {
+        std::size_t min = (c == '+') ? 1 : 0;
+        if (c == '{') {
+          for (++i; i < p.size() && p[i] >= '0' && p[i] <= '9'; ++i) {
+            min = min * 10 + (p[i] - '0');
+          }
+          while (i < p.size() && p[i] != '}') ++i;
+        }
+        if (i + 1 < p.size() && p[i + 1] == '?') ++i;  // lazy
+        if (atom_literal && min == 0) {
+          runs.back().pop_back();  // the character is optional
+        }
+        cut();
+        atom_literal = false;
+        continue;
+      }
+      char literal = 0;
+      bool is_literal = false;
+      if (c == '\\' && i + 1 < p.size()) {
+        const char e = p[++i];
+        switch (e) {
+          case 'n': literal = '\n'; is_literal = true; break;
+          case 't': literal = '\t'; is_literal = true; break;
+          case 'r': literal = '\r'; is_literal = true; break;
+          case 'f': literal = '\f'; is_literal = true; break;
+          case 'v': literal = '\v'; is_literal = true; break;
+          case 'c': i += 1; break;
+          case 'x': i += 2; break;
+          case 'u': i += 4; break;
+          default:
+            if (e >= '0' && e <= '9') {
+              while (i + 1 < p.size() && p[i + 1] >= '0' && p[i + 1] <= '9') {
+                ++i;
+              }
+            } else if (std::strchr("\\^$.*+?()[]{}|/-", e)) {
+              literal = e;
+              is_literal = true;
+            }
+        }
+      } else if (c == '[') {
+        i = skip_class(p, i);
+      } else if (c == '(') {
+        i = skip_group(p, i);
+      } else if (!std::strchr(".$^)]}\\", c)) {
+        literal = c;
+        is_literal = true;
+      }
+      atom_literal = is_literal;
+      if (!is_literal) {
+        cut();
+        continue;
+      }
+      // a quantifier binds to this character alone
+      const char next = i + 1 < p.size() ? p[i + 1] : '\0';
+      if (next == '*' || next == '?' || next == '+' || next == '{') {
+        cut();
+      }
+      if (prefix_open) {
+        _prefix += literal;
+      } else {
+        runs.back() += literal;
+      }
+    }
+    _needs_regex = !whole;
+    for (auto& run : runs) {
+      if (!run.empty()) _literals.push_back(std::move(run));
+    }
+  }
+
+public:
+  key_filter() = default;
+
+  /**
+   * @throws std::regex_error if the pattern is invalid
+   */
+  explicit key_filter(const std::string& pattern)
+    : _pat{pattern},
+      _active{!pattern.empty()} {
+    if (_active) analyze(pattern);
+  }
+
+  bool active() const noexcept { return _active; }
+  const std::string& prefix() const noexcept { return _prefix; }
+  const std::vector<std::string>& literals() const noexcept {
+    return _literals;
+  }
+
+  /**
+   * Returns whether a key starts with the literal prefix. Keys with the
+   * prefix are contiguous in the default key order, so a scan may start
+   * at the prefix and stop at the first key without it.
+   */
+  bool has_prefix(const char* const data,
+                  const std::size_t size) const noexcept {
+    return size >= _prefix.size()
+      && std::memcmp(data, _prefix.data(), _prefix.size()) == 0;
+  }
+
+  /**
+   * Returns whether the pattern is found in a key or value.
+   */
+  bool operator()(const char* const data,
+                  const std::size_t size) const {
+    if (!_active) return true;
+    if (!has_prefix(data, size)) return false;
+    for (const auto& literal : _literals) {
+      if (!find_literal(data, size, literal.data(), literal.size())) {
+        return false;
+      }
+    }
+    return !_needs_regex || std::regex_search(data, data + size, _pat);
+  }
+};
+
+/**
+ * Aho-Corasick automaton reporting every occurrence of a set of literals.
+ *
+ * Transitions form a complete table over the classes of bytes that occur
+ * in the literals, so a scan costs one table lookup per byte.
+ */
+class literal_automaton {
+  std::uint16_t _class[256] = {};  // 0: a byte no literal contains
+  std::size_t _nclasses{1};
+  std::vector<std::uint32_t> _delta;  // state * _nclasses + class
+  std::vector<std::vector<std::size_t>> _out;  // ids ending at a state
+
+public:
+  /**
+   * Compiles (literal, id) pairs; literals must not be empty.
+   */
+  void build(const std::vector<std::pair<std::string, std::size_t>>& literals) {
+    std::fill(std::begin(_class), std::end(_class), 0);
+    _nclasses = 1;
+    _delta.clear();
+    _out.clear();
+    if (literals.empty()) return;
+    for (const auto& l : literals) {
+      for (const unsigned char c : l.first) {
+        if (_class[c] == 0) {
+          _class[c] = static_cast<std::uint16_t>(_nclasses++);
+        }
+      }
+    }
+    const std::uint32_t none = ~static_cast<std::uint32_t>(0);
+    _delta.assign(_nclasses, none);
+    _out.assign(1, std::vector<std::size_t>());
+    for (const auto& l : literals) {  // trie
+      std::uint32_t s = 0;
+      for (const unsigned char c : l.first) {
+        std::uint32_t& t = _delta[s * _nclasses + _class[c]];
+        if (t == none) {
+          t = static_cast<std::uint32_t>(_out.size());
+          _out.emplace_back();
+          _delta.resize(_delta.size() + _nclasses, none);
+        }
+        s = _delta[s * _nclasses + _class[c]];
+      }
+      _out[s].push_back(l.second);
+    }
+    std::vector<std::uint32_t> fail(_out.size(), 0);
+    std::deque<std::uint32_t> queue;
+    for (std::size_t c = 0; c < _nclasses; ++c) {
+      std::uint32_t& t = _delta[c];
+      if (t == none) {
+        t = 0;
+      } else {
+        queue.push_back(t);
+      }
+    }
+    while (!queue.empty()) {  // breadth first, so fail[s] is complete
+      const std::uint32_t s = queue.front();
+      queue.pop_front();
+      const auto& inherited = _out[fail[s]];
+      _out[s].insert(_out[s].end(), inherited.begin(), inherited.end());
+      for (std::size_t c = 0; c < _nclasses; ++c) {
+        std::uint32_t& t = _delta[s * _nclasses + c];
+        const std::uint32_t f = _delta[fail[s] * _nclasses + c];
+        if (t == none) {
+          t = f;
+        } else {
+          fail[t] = f;
+          queue.push_back(t);
+        }
+      }
+    }
+  }
+
+  /**
+   * Calls `f(id)` for every occurrence of a literal in the text.
+   */
+  template<typename F>
+  void scan(const char* const data,
+            const std::size_t size,
+            F f) const {
+    if (_delta.empty()) return;
+    std::uint32_t s = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      s = _delta[s * _nclasses + _class[static_cast<unsigned char>(data[i])]];
+      for (const std::size_t id : _out[s]) f(id);
+    }
+  }
+};
+
+/**
+ * Set of key patterns matched against a key in one pass.
+ *
+ * Each pattern is represented in the automaton by the longest of its
+ * literals (the prefix included). A key is verified against only the
+ * patterns whose literal occurs in it, plus those without any literal.
+ */
+class pattern_set {
+  std::vector<key_filter> _filters;
+  literal_automaton _automaton;
+  std::vector<std::size_t> _always;  // patterns without literals
+  std::string _prefix;  // literal prefix common to all patterns
+
+public:
+  /**
+   * Adds a pattern and returns its id; `build()` must follow.
+   *
+   * @throws std::regex_error if the pattern is invalid
+   */
+  std::size_t add(const std::string& pattern) {
+    _filters.emplace_back(pattern);
+    return _filters.size() - 1;
+  }
+
+  void build() {
+    std::vector<std::pair<std::string, std::size_t>> literals;
+    _always.clear();
+    for (std::size_t id = 0; id < _filters.size(); ++id) {
+      const key_filter& f = _filters[id];
+      std::string longest = f.prefix();
+      for (const auto& literal : f.literals()) {
+        if (literal.size() > longest.size()) longest = literal;
+      }
+      if (longest.empty()) {
+        _always.push_back(id);
+      } else {
+        literals.emplace_back(std::move(longest), id);
+      }
+      const std::string& p = f.prefix();
+      if (id == 0) {
+        _prefix = p;
+      } else {
+        std::size_t n = 0;
+        while (n < _prefix.size() && n < p.size() && _prefix[n] == p[n]) ++n;
+        _prefix.resize(n);
+      }
+    }
+    _automaton.build(literals);
+  }
+
+  std::size_t size() const noexcept { return _filters.size(); }
+  const key_filter& operator[](const std::size_t id) const {
+    return _filters[id];
+  }
+
+  /**
+   * Returns the literal prefix all patterns share; keys without it match
+   * none of them.
+   */
+  const std::string& prefix() const noexcept { return _prefix; }
+
+  /**
+   * Stores the ids of the patterns found in a key, in ascending order.
+   */
+  void match(const char* const data,
+             const std::size_t size,
+             std::vector<std::size_t>& ids) const {
+    ids.assign(_always.begin(), _always.end());
+    _automaton.scan(data, size, [&ids](std::size_t id) { ids.push_back(id); });
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    ids.erase(std::remove_if(ids.begin(), ids.end(),
+                             [this, data, size](std::size_t id) {
+      return !_filters[id](data, size);
+    }), ids.end());
+  }
+};
+
+/**
+ * Reads a pattern file of `<pattern> TAB <destination>` lines, skipping
+ * empty lines and lines starting with '#'. The destination follows the
+ * last tab of a line.
+ *
+ * @throws std::runtime_error if the file cannot be read or a line has no
+ *         destination
+ */
+inline std::vector<std::pair<std::string, std::string>>
+read_routes(const std::string& path) {
+  std::ifstream ifs(path);
+  if (!ifs) throw std::runtime_error(path + ": cannot open pattern file");
+  std::vector<std::pair<std::string, std::string>> routes;
+  std::size_t lineno = 0;
+  for (std::string line; std::getline(ifs, line);) {
+    ++lineno;
+    if (line.empty() || line[0] == '#') continue;
+    const std::size_t tab = line.rfind('\t');
+    if (tab == std::string::npos || tab == 0 || tab + 1 == line.size()) {
+      throw std::runtime_error(path + ":" + std::to_string(lineno)
+                               + ": expected <pattern> TAB <destination>");
+    }
+    routes.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+  }
+  return routes;
+}
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_KEYFILTER_HH
@@ -0,0 +1,242 @@
+#ifndef LMDBTOOLS_KEYSCHEMA_HH
+#define LMDBTOOLS_KEYSCHEMA_HH
+
+/**
+ * Runtime key schema of composite keys.
+ *
+ * A schema is a comma separated list of key components: `i8`, `i16`,
+ * `i32` and `i64` for signed integers, `u8` to `u64` for unsigned ones,
+ * `s<N>` for strings of `N` bytes and `s` for strings of any length, as
+ * in "s,u64,u32" for (tenant, timestamp, id) keys. The tools read and
+ * write such keys as comma separated text, "acme,1700000000,42", and
+ * store them with the order-preserving encodings of the `lmdb::key_codec`
+ * components, so the byte order of the keys is the order of the tuples
+ * and the keys starting with given leading components share a prefix.
+ * The last component of the text runs to its end and may contain commas.
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "lmdb++.h"
+
+namespace lmdbtools {
+
+class key_schema {
+public:
+  enum class kind { sint, uint, fixed, string };
+
+  struct component {
+    kind type;
+    std::size_t size;  // bytes of an integer or fixed string
+  };
+
+  key_schema() = default;
+
+  /**
+   * @throws std::runtime_error on an unknown component
+   */
+  explicit key_schema(const std::string& spec) {
+    for (std::size_t pos = 0; pos <= spec.size();) {
+      std::size_t comma = spec.find(',', pos);
+      if (comma == std::string::npos) comma = spec.size();
+      _components.push_back(parse(spec.substr(pos, comma - pos)));
+      pos = comma + 1;
+    }
+  }
+
+  bool empty() const noexcept { return _components.empty(); }
+  std::size_t size() const noexcept { return _components.size(); }
+
+  /**
+   * Encodes comma separated component text into `key`. With `prefix`,
+   * the text may hold the leading components only, which encode to the
+   * prefix of the keys starting with them.
+   *
+   * @throws std::runtime_error on text that does not fit the schema
+   */
+  void encode(const char* text, std::size_t size, std::string& key,
+              bool prefix = false) const {
+    key.clear();
+    const char* const begin = text;
+    const char* const end = text + size;
+    for (std::size_t i = 0; i < _components.size(); ++i) {
+      if (prefix && text == end) return;
+      const char* field_end = end;
+      if (i + 1 < _components.size()) {
+        field_end = static_cast<const char*>(
+          std::memchr(text, ',', end - text));
+        if (!field_end) {
+          if (!prefix) fail("too few components", begin, end);
+          field_end = end;
+        }
+      }
+      put(_components[i], text, field_end, key);
+      text = field_end == end ? end : field_end + 1;
+    }
+  }
+
+  std::string encode(const std::string& text, bool prefix = false) const {
+    std::string key;
+    encode(text.data(), text.size(), key, prefix);
+    return key;
+  }
+
+  /**
+   * Appends the comma separated component text of an encoded key to `out`,
+   * anything with `append(const char*, std::size_t)`.
+   *
+   * @throws std::runtime_error on a key that does not fit the schema
+   */
+  template<typename Out>
+  void decode(const char* key, std::size_t size, Out& out) const {
+    const char* p = key;
+    const char* const end = key + size;
+    std::string text;  // decoded string component
+    for (std::size_t i = 0; i < _components.size(); ++i) {
+      if (i > 0) out.append(",", 1);
+      const component& c = _components[i];
+      bool ok = false;
+      switch (c.type) {
+        case kind::sint:
+          switch (c.size) {
+            case 1: ok = append_int<int8_t>(p, end, out); break;
+            case 2: ok = append_int<int16_t>(p, end, out); break;
+            case 4: ok = append_int<int32_t>(p, end, out); break;
+            default: ok = append_int<int64_t>(p, end, out); break;
+          }
+          break;
+        case kind::uint:
+          switch (c.size) {
+            case 1: ok = append_int<uint8_t>(p, end, out); break;
+            case 2: ok = append_int<uint16_t>(p, end, out); break;
+            case 4: ok = append_int<uint32_t>(p, end, out); break;
+            default: ok = append_int<uint64_t>(p, end, out); break;
+          }
+          break;
+        case kind::fixed:
+          ok = static_cast<std::size_t>(end - p) >= c.size;
+          if (ok) {
+            std::size_t n = c.size;
+            while (n > 0 && p[n - 1] == '\0') --n;
+            out.append(p, n);
+            p += c.size;
+          }
+          break;
+        case kind::string:
+          ok = lmdb::key_string::decode(p, end, text);
+          if (ok) out.append(text.data(), text.size());
+          break;
+      }
+      if (!ok) fail("key does not fit the schema", key, end);
+    }
+    if (p != end) fail("key does not fit the schema", key, end);
+  }
+
+private:
+  std::vector<component> _components;
+
+  static component parse(const std::string& name) {
+    if (name == "s") return component{kind::string, 0};
+    static const char* const ints[] = {"8", "16", "32", "64"};
+    for (std::size_t b = 0; b < 4; ++b) {
+      if (name.size() > 1 && name.compare(1, std::string::npos, ints[b]) == 0
+          && (name[0] == 'i' || name[0] == 'u')) {
+        return component{name[0] == 'i' ? kind::sint : kind::uint,
+                         std::size_t(1) << b};
+      }
+    }
+    if (name.size() > 1 && name[0] == 's'
+        && name.find_first_not_of("0123456789", 1) == std::string::npos) {
+      const unsigned long n = std::strtoul(name.c_str() + 1, nullptr, 10);
+      if (n > 0 && n <= 511) return component{kind::fixed, n};
+    }
+    throw std::runtime_error("unknown key component: \"" + name + "\"");
+  }
+
+  [[noreturn]] static void fail(const char* what, const char* begin,
+                                const char* end) {
+    throw std::runtime_error(std::string(what) + ": "
+                             + std::string(begin, end));
+  }
+
+  template<typename T>
+  static void put_int(T v, std::string& key) {
+    char buf[sizeof(T)];
+    lmdb::key_int<T>::encode(v, buf, sizeof(buf));
+    key.append(buf, sizeof(buf));
+  }
+
+  // Decodes an integer with the encoding of lmdb::key_int<T> and appends
+  // its decimal text.
+  template<typename T, typename Out>
+  static bool append_int(const char*& p, const char* end, Out& out) {
+    T v;
+    if (!lmdb::key_int<T>::decode(p, end, v)) return false;
+    char digits[24];
+    const int n = std::is_signed<T>::value
+      ? std::snprintf(digits, sizeof(digits), "%lld",
+                      static_cast<long long>(v))
+      : std::snprintf(digits, sizeof(digits), "%llu",
+                      static_cast<unsigned long long>(v));
+    out.append(digits, n);
+    return true;
+  }
+
+  static void put(const component& c, const char* begin, const char* end,
+                  std::string& key) {
+    const std::string field(begin, end);
+    if (c.type == kind::string) {
+      const std::size_t at = key.size();
+      key.resize(at + lmdb::key_string::encode(field, nullptr, 0));
+      lmdb::key_string::encode(field, &key[at], key.size() - at);
+      return;
+    }
+    if (c.type == kind::fixed) {
+      if (field.size() > c.size) fail("string too long", begin, end);
+      key.append(field).append(c.size - field.size(), '\0');
+      return;
+    }
+    // the whole field must be a number within the range of the component
+    const unsigned bits = 8 * c.size;
+    char* stop = nullptr;
+    errno = 0;
+    if (c.type == kind::sint) {
+      const long long v = std::strtoll(field.c_str(), &stop, 10);
+      const long long lim = bits < 64 ? 1LL << (bits - 1) : 0;
+      if (field.empty() || *stop != '\0' || errno == ERANGE
+          || (bits < 64 && (v < -lim || v >= lim))) {
+        fail("invalid integer", begin, end);
+      }
+      switch (c.size) {
+        case 1: put_int<int8_t>(v, key); break;
+        case 2: put_int<int16_t>(v, key); break;
+        case 4: put_int<int32_t>(v, key); break;
+        default: put_int<int64_t>(v, key); break;
+      }
+    } else {
+      const unsigned long long v = std::strtoull(field.c_str(), &stop, 10);
+      if (field.empty() || field[0] == '-' || *stop != '\0' || errno == ERANGE
+          || (bits < 64 && v >> bits != 0)) {
+        fail("invalid integer", begin, end);
+      }
+      switch (c.size) {
+        case 1: put_int<uint8_t>(v, key); break;
+        case 2: put_int<uint16_t>(v, key); break;
+        case 4: put_int<uint32_t>(v, key); break;
+        default: put_int<uint64_t>(v, key); break;
+      }
+    }
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_KEYSCHEMA_HH
@@ -27,12 +27,21 @@
 #ifdef LMDBXX_DEBUG
 #include <cassert>     /* for assert() */
 #endif
+#include <algorithm>   /* for std::stable_sort() */
+#include <chrono>      /* for std::chrono::steady_clock */
 #include <cstddef>     /* for std::size_t */
+#include <cstdint>     /* for std::uint64_t */
 #include <cstdio>      /* for std::snprintf() */
-#include <cstring>     /* for std::strlen() */
+#include <cstdlib>     /* for std::atexit() */
+#include <cstring>     /* for std::memcmp(), std::strlen() */
+#include <functional>  /* for std::function */
+#include <iterator>    /* for std::input_iterator_tag */
+#include <mutex>       /* for std::mutex, std::lock_guard<> */
 #include <stdexcept>   /* for std::runtime_error */
 #include <string>      /* for std::string */
 #include <type_traits> /* for std::is_pod<> */
+#include <utility>     /* for std::move() */
+#include <vector>      /* for std::vector */
 
 namespace lmdb {
   using mode = mdb_mode_t;
@@ -215,6 +224,265 @@ lmdb::error::raise(const char* const origin,
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/* Instrumentation */
+
+/*
+ * Building with `LMDBXX_INSTRUMENT` defined makes the get, put, del,
+ * cursor and commit calls of the procedural interface count their calls
+ * and bytes and record their latency in power-of-two histograms, timed by
+ * the time stamp counter where there is one. Without it the probes expand
+ * to nothing and `lmdb::instrument::print()` does nothing.
+ */
+
+#ifdef LMDBXX_INSTRUMENT
+#include <atomic>      /* for std::atomic<> */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> /* for __rdtsc() */
+#endif
+#endif
+
+namespace lmdb {
+  enum class op_type : unsigned int {
+    get, put, del, cursor_get, cursor_put, cursor_del, commit,
+  };
+  class instrument;
+#ifdef LMDBXX_INSTRUMENT
+  class probe;
+#endif
+}
+
+#ifdef LMDBXX_INSTRUMENT
+
+/**
+ * Per-call-type counters of the instrumented calls.
+ *
+ * Each thread counts into a table of its own, which it merges into the
+ * totals when it exits, so the counting threads never share a cache line.
+ */
+class lmdb::instrument {
+public:
+  static constexpr bool enabled = true;
+  static constexpr unsigned int types = 7;
+  static constexpr unsigned int buckets = 64;
+
+  /**
+   * Returns the current time in ticks, cycles of the time stamp counter
+   * or nanoseconds.
+   */
+  static unsigned long long ticks() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  static const char* tick_unit() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    return "cycles";
+#else
+    return "ns";
+#endif
+  }
+
+  /**
+   * Counts a call.
+   */
+  static void record(const op_type type,
+                     const std::size_t bytes,
+                     const unsigned long long elapsed) noexcept {
+    counters& c = local().ops[static_cast<unsigned int>(type)];
+    bump(c.calls, 1);
+    bump(c.bytes, bytes);
+    bump(c.ticks, elapsed);
+    unsigned int b = 0;
+    for (unsigned long long t = elapsed; t > 0 && b + 1 < buckets; t >>= 1) {
+      ++b;
+    }
+    bump(c.histogram[b], 1);  // 0: no tick, b: [2^(b-1), 2^b)
+  }
+
+  /**
+   * Writes a line of totals per call type that was called.
+   */
+  static void print(std::FILE* const out = stderr) {
+    static const char* const names[types] = {
+      "get", "put", "del", "cursor_get", "cursor_put", "cursor_del", "commit",
+    };
+    totals sum{};
+    {
+      registry& r = reg();
+      std::lock_guard<std::mutex> lock{r.mutex};
+      add(sum, r.retired);
+      for (const table* const t : r.live) {
+        add(sum, *t);
+      }
+    }
+    for (unsigned int i = 0; i < types; ++i) {
+      const unsigned long long calls = sum.calls[i];
+      if (calls == 0) continue;
+      std::fprintf(out, "lmdb %s: %llu calls, %llu bytes, %.1f %s/call "
+                   "(p50 < %llu, p99 < %llu)\n", names[i], calls,
+                   sum.bytes[i], double(sum.ticks[i]) / calls, tick_unit(),
+                   percentile(sum.histogram[i], calls, 0.50),
+                   percentile(sum.histogram[i], calls, 0.99));
+    }
+  }
+
+  /**
+   * Prints the totals to `stderr` when the program exits.
+   */
+  static void print_at_exit() {
+    reg();  // constructed before, hence destroyed after, the handler
+    std::atexit([] { print(stderr); });
+  }
+
+private:
+  struct counters {
+    std::atomic<unsigned long long> calls{0};
+    std::atomic<unsigned long long> bytes{0};
+    std::atomic<unsigned long long> ticks{0};
+    std::atomic<unsigned long long> histogram[buckets]{};
+  };
+
+  struct table {
+    counters ops[types];
+  };
+
+  struct totals {
+    unsigned long long calls[types];
+    unsigned long long bytes[types];
+    unsigned long long ticks[types];
+    unsigned long long histogram[types][buckets];
+  };
+
+  struct registry {
+    std::mutex mutex;
+    table retired;
+    std::vector<const table*> live;
+  };
+
+  // Table of one thread, registered while the thread runs.
+  struct local_table : table {
+    local_table() {
+      registry& r = reg();
+      std::lock_guard<std::mutex> lock{r.mutex};
+      r.live.push_back(this);
+    }
+
+    ~local_table() {
+      registry& r = reg();
+      std::lock_guard<std::mutex> lock{r.mutex};
+      for (unsigned int i = 0; i < types; ++i) {
+        merge(r.retired.ops[i].calls, ops[i].calls);
+        merge(r.retired.ops[i].bytes, ops[i].bytes);
+        merge(r.retired.ops[i].ticks, ops[i].ticks);
+        for (unsigned int b = 0; b < buckets; ++b) {
+          merge(r.retired.ops[i].histogram[b], ops[i].histogram[b]);
+        }
+      }
+      r.live.erase(std::find(r.live.begin(), r.live.end(), this));
+    }
+  };
+
+  static registry& reg() {
+    static registry r;
+    return r;
+  }
+
+  static table& local() {
+    static thread_local local_table t;
+    return t;
+  }
+
+  // Only the owning thread writes a counter, so no atomic read-modify-write
+  // is needed.
+  static void bump(std::atomic<unsigned long long>& c,
+                   const unsigned long long n) noexcept {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static void merge(std::atomic<unsigned long long>& to,
+                    const std::atomic<unsigned long long>& from) noexcept {
+    bump(to, from.load(std::memory_order_relaxed));
+  }
+
+  static void add(totals& sum, const table& t) noexcept {
+    for (unsigned int i = 0; i < types; ++i) {
+      sum.calls[i] += t.ops[i].calls.load(std::memory_order_relaxed);
+      sum.bytes[i] += t.ops[i].bytes.load(std::memory_order_relaxed);
+      sum.ticks[i] += t.ops[i].ticks.load(std::memory_order_relaxed);
+      for (unsigned int b = 0; b < buckets; ++b) {
+        sum.histogram[i][b] +=
+          t.ops[i].histogram[b].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Upper bound of the histogram bucket holding the given quantile.
+  static unsigned long long percentile(const unsigned long long* histogram,
+                                       const unsigned long long calls,
+                                       const double q) noexcept {
+    unsigned long long seen = 0;
+    for (unsigned int b = 0; b < buckets; ++b) {
+      seen += histogram[b];
+      if (seen >= q * calls) {
+        return b + 1 < buckets ? 1ULL << b : ~0ULL;
+      }
+    }
+    return ~0ULL;
+  }
+};
+
+/**
+ * Scoped timer of one instrumented call.
+ */
+class lmdb::probe {
+  const op_type _type;
+  std::size_t _bytes{0};
+  const unsigned long long _start;
+
+public:
+  explicit probe(const op_type type) noexcept
+    : _type{type}, _start{instrument::ticks()} {}
+
+  probe(const probe&) = delete;
+  probe& operator=(const probe&) = delete;
+
+  ~probe() noexcept {
+    instrument::record(_type, _bytes, instrument::ticks() - _start);
+  }
+
+  void add(const std::size_t bytes) noexcept {
+    _bytes += bytes;
+  }
+};
+
+#define LMDBXX_PROBE(type) \
+  lmdb::probe lmdbxx_probe_{lmdb::op_type::type}
+#define LMDBXX_PROBE_BYTES(bytes) \
+  lmdbxx_probe_.add(bytes)
+
+#else /* LMDBXX_INSTRUMENT */
+
+/**
+ * Stand-in of the instrumentation when it is not built in.
+ */
+class lmdb::instrument {
+public:
+  static constexpr bool enabled = false;
+
+  static void print(std::FILE* = stderr) noexcept {}
+  static void print_at_exit() noexcept {}
+};
+
+#define LMDBXX_PROBE(type) ((void)0)
+#define LMDBXX_PROBE_BYTES(bytes) ((void)0)
+
+#endif /* LMDBXX_INSTRUMENT */
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Procedural Interface: Metadata */
 
@@ -572,6 +840,7 @@ lmdb::txn_id(MDB_txn* const txn) noexcept {
  */
 static inline void
 lmdb::txn_commit(MDB_txn* const txn) {
+  LMDBXX_PROBE(commit);
   const int rc = ::mdb_txn_commit(txn);
   if (rc != MDB_SUCCESS) {
     error::raise("mdb_txn_commit", rc);
@@ -758,10 +1027,12 @@ lmdb::dbi_get(MDB_txn* const txn,
               const MDB_dbi dbi,
               const MDB_val* const key,
               MDB_val* const data) {
+  LMDBXX_PROBE(get);
   const int rc = ::mdb_get(txn, dbi, const_cast<MDB_val*>(key), data);
   if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND) {
     error::raise("mdb_get", rc);
   }
+  LMDBXX_PROBE_BYTES(key->mv_size + (rc == MDB_SUCCESS ? data->mv_size : 0));
   return (rc == MDB_SUCCESS);
 }
 
@@ -776,6 +1047,8 @@ lmdb::dbi_put(MDB_txn* const txn,
               const MDB_val* const key,
               MDB_val* const data,
               const unsigned int flags = 0) {
+  LMDBXX_PROBE(put);
+  LMDBXX_PROBE_BYTES(key->mv_size + data->mv_size);
   const int rc = ::mdb_put(txn, dbi, const_cast<MDB_val*>(key), data, flags);
   if (rc != MDB_SUCCESS && rc != MDB_KEYEXIST) {
     error::raise("mdb_put", rc);
@@ -793,6 +1066,8 @@ lmdb::dbi_del(MDB_txn* const txn,
               const MDB_dbi dbi,
               const MDB_val* const key,
               const MDB_val* const data = nullptr) {
+  LMDBXX_PROBE(del);
+  LMDBXX_PROBE_BYTES(key->mv_size);
   const int rc = ::mdb_del(txn, dbi, const_cast<MDB_val*>(key), const_cast<MDB_val*>(data));
   if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND) {
     error::raise("mdb_del", rc);
@@ -875,10 +1150,13 @@ lmdb::cursor_get(MDB_cursor* const cursor,
                  MDB_val* const key,
                  MDB_val* const data,
                  const MDB_cursor_op op) {
+  LMDBXX_PROBE(cursor_get);
   const int rc = ::mdb_cursor_get(cursor, key, data, op);
   if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND) {
     error::raise("mdb_cursor_get", rc);
   }
+  LMDBXX_PROBE_BYTES(rc == MDB_SUCCESS
+                     ? key->mv_size + (data ? data->mv_size : 0) : 0);
   return (rc == MDB_SUCCESS);
 }
 
@@ -891,6 +1169,8 @@ lmdb::cursor_put(MDB_cursor* const cursor,
                  MDB_val* const key,
                  MDB_val* const data,
                  const unsigned int flags = 0) {
+  LMDBXX_PROBE(cursor_put);
+  LMDBXX_PROBE_BYTES(key->mv_size + data->mv_size);
   const int rc = ::mdb_cursor_put(cursor, key, data, flags);
   if (rc != MDB_SUCCESS) {
     error::raise("mdb_cursor_put", rc);
@@ -904,6 +1184,7 @@ lmdb::cursor_put(MDB_cursor* const cursor,
 static inline void
 lmdb::cursor_del(MDB_cursor* const cursor,
                  const unsigned int flags = 0) {
+  LMDBXX_PROBE(cursor_del);
   const int rc = ::mdb_cursor_del(cursor, flags);
   if (rc != MDB_SUCCESS) {
     error::raise("mdb_cursor_del", rc);
@@ -923,6 +1204,300 @@ lmdb::cursor_count(MDB_cursor* const cursor,
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/* Procedural Interface: Comparators */
+
+namespace lmdb {
+  static inline int compare_bytes(const MDB_val* a, const MDB_val* b) noexcept;
+  static inline int compare_reverse(const MDB_val* a, const MDB_val* b) noexcept;
+  static inline int compare_numeric(const MDB_val* a, const MDB_val* b) noexcept;
+}
+
+/**
+ * Compares keys bytewise, as LMDB does by default, with a shorter key
+ * before the longer ones it is a prefix of. Keys differing in their first
+ * eight bytes are told apart by one word comparison; a longer common
+ * prefix is left to `memcmp()`, which the C library vectorizes.
+ *
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga68e47ffcf72eceec553c72b1784ee0fe
+ */
+static inline int
+lmdb::compare_bytes(const MDB_val* const a,
+                    const MDB_val* const b) noexcept {
+  const std::size_t n = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+  const char* const x = static_cast<const char*>(a->mv_data);
+  const char* const y = static_cast<const char*>(b->mv_data);
+  std::size_t i = 0;
+#if defined(__GNUC__) || defined(__clang__)
+  if (n >= sizeof(std::uint64_t)) {
+    std::uint64_t u, v;
+    std::memcpy(&u, x, sizeof(u));
+    std::memcpy(&v, y, sizeof(v));
+    if (u != v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      u = __builtin_bswap64(u);
+      v = __builtin_bswap64(v);
+#endif
+      return u < v ? -1 : 1;
+    }
+    i = sizeof(std::uint64_t);
+  }
+#endif
+  const int rc = std::memcmp(x + i, y + i, n - i);
+  if (rc != 0) return rc;
+  return a->mv_size < b->mv_size ? -1 : a->mv_size > b->mv_size;
+}
+
+/**
+ * Compares keys bytewise from their last bytes backwards, the order of
+ * `MDB_REVERSEKEY`.
+ */
+static inline int
+lmdb::compare_reverse(const MDB_val* const a,
+                      const MDB_val* const b) noexcept {
+  const std::size_t n = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+  const unsigned char* x = static_cast<const unsigned char*>(a->mv_data)
+    + a->mv_size;
+  const unsigned char* y = static_cast<const unsigned char*>(b->mv_data)
+    + b->mv_size;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (*--x != *--y) return int(*x) - int(*y);
+  }
+  return a->mv_size < b->mv_size ? -1 : a->mv_size > b->mv_size;
+}
+
+/**
+ * Compares keys by the value of the decimal number they start with, then
+ * by the rest bytewise, so that "9" comes before "10" and "10a" before
+ * "10b". Keys equal in both, as "7" and "007", are ordered bytewise.
+ */
+static inline int
+lmdb::compare_numeric(const MDB_val* const a,
+                      const MDB_val* const b) noexcept {
+  const char* const x = static_cast<const char*>(a->mv_data);
+  const char* const y = static_cast<const char*>(b->mv_data);
+  const auto digits = [](const char* p, const std::size_t size,
+                         std::size_t& zeros) {
+    std::size_t n = 0;
+    while (n < size && p[n] >= '0' && p[n] <= '9') ++n;
+    for (zeros = 0; zeros + 1 < n && p[zeros] == '0'; ++zeros) {}
+    return n;
+  };
+  std::size_t zx, zy;
+  const std::size_t nx = digits(x, a->mv_size, zx);
+  const std::size_t ny = digits(y, b->mv_size, zy);
+  // a number without leading zeros is the larger the more digits it has
+  if (nx - zx != ny - zy) return nx - zx < ny - zy ? -1 : 1;
+  int rc = std::memcmp(x + zx, y + zy, nx - zx);
+  if (rc == 0) {
+    const MDB_val rx{a->mv_size - nx, const_cast<char*>(x + nx)};
+    const MDB_val ry{b->mv_size - ny, const_cast<char*>(y + ny)};
+    rc = compare_bytes(&rx, &ry);
+  }
+  return rc != 0 ? rc : compare_bytes(a, b);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/* Procedural Interface: Status Codes */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LMDBXX_FORCE_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define LMDBXX_FORCE_INLINE __forceinline
+#else
+#define LMDBXX_FORCE_INLINE inline
+#endif
+
+namespace lmdb {
+  class status;
+}
+
+/**
+ * Return code of a non-throwing call.
+ *
+ * The `try_*` functions below return the LMDB return code as is, instead
+ * of throwing and of folding `MDB_NOTFOUND` and `MDB_KEYEXIST` into a
+ * `bool`. They are forced inline and `noexcept`, so that hot loops pay
+ * for neither exception tables nor wrapper branches, and a caller that
+ * retries on `MDB_MAP_FULL` tests a code instead of catching.
+ */
+class lmdb::status {
+  int _rc;
+
+public:
+  constexpr status(const int rc = MDB_SUCCESS) noexcept
+    : _rc{rc} {}
+
+  /**
+   * Returns the underlying LMDB return code.
+   */
+  constexpr int code() const noexcept {
+    return _rc;
+  }
+
+  /**
+   * Determines whether the call succeeded.
+   */
+  constexpr bool ok() const noexcept {
+    return _rc == MDB_SUCCESS;
+  }
+
+  constexpr explicit operator bool() const noexcept {
+    return ok();
+  }
+
+  constexpr bool not_found() const noexcept {
+    return _rc == MDB_NOTFOUND;
+  }
+
+  constexpr bool key_exist() const noexcept {
+    return _rc == MDB_KEYEXIST;
+  }
+
+  constexpr bool map_full() const noexcept {
+    return _rc == MDB_MAP_FULL;
+  }
+
+  /**
+   * Returns the description of the return code.
+   */
+  const char* what() const noexcept {
+    return ::mdb_strerror(_rc);
+  }
+
+  /**
+   * Throws the error of a failed call.
+   *
+   * @param origin the name of the failed function
+   * @throws lmdb::error unless the call succeeded
+   */
+  void check(const char* const origin) const {
+    if (_rc != MDB_SUCCESS) {
+      error::raise(origin, _rc);
+    }
+  }
+};
+
+namespace lmdb {
+  static LMDBXX_FORCE_INLINE status try_txn_begin(MDB_env* env, MDB_txn* parent, unsigned int flags, MDB_txn** txn) noexcept;
+  static LMDBXX_FORCE_INLINE status try_txn_commit(MDB_txn* txn) noexcept;
+  static LMDBXX_FORCE_INLINE status try_txn_renew(MDB_txn* txn) noexcept;
+  static LMDBXX_FORCE_INLINE status try_dbi_get(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, MDB_val* data) noexcept;
+  static LMDBXX_FORCE_INLINE status try_dbi_put(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, MDB_val* data, unsigned int flags) noexcept;
+  static LMDBXX_FORCE_INLINE status try_dbi_del(MDB_txn* txn, MDB_dbi dbi, const MDB_val* key, const MDB_val* data) noexcept;
+  static LMDBXX_FORCE_INLINE status try_cursor_get(MDB_cursor* cursor, MDB_val* key, MDB_val* data, MDB_cursor_op op) noexcept;
+  static LMDBXX_FORCE_INLINE status try_cursor_put(MDB_cursor* cursor, MDB_val* key, MDB_val* data, unsigned int flags) noexcept;
+  static LMDBXX_FORCE_INLINE status try_cursor_del(MDB_cursor* cursor, unsigned int flags) noexcept;
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#gad7ea55da06b77513609efebd44b26920
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_txn_begin(MDB_env* const env,
+                    MDB_txn* const parent,
+                    const unsigned int flags,
+                    MDB_txn** txn) noexcept {
+  return ::mdb_txn_begin(env, parent, flags, txn);
+}
+
+/**
+ * @note the transaction is freed even if the commit fails
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga846fbd6f46105617ac9f4d76476f6597
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_txn_commit(MDB_txn* const txn) noexcept {
+  LMDBXX_PROBE(commit);
+  return ::mdb_txn_commit(txn);
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga6c6f917959517ede1c504cf7c720ce6d
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_txn_renew(MDB_txn* const txn) noexcept {
+  return ::mdb_txn_renew(txn);
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga8bf10cd91d3f3a83a34d04ce6b07992d
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_dbi_get(MDB_txn* const txn,
+                  const MDB_dbi dbi,
+                  const MDB_val* const key,
+                  MDB_val* const data) noexcept {
+  LMDBXX_PROBE(get);
+  const int rc = ::mdb_get(txn, dbi, const_cast<MDB_val*>(key), data);
+  LMDBXX_PROBE_BYTES(key->mv_size + (rc == MDB_SUCCESS ? data->mv_size : 0));
+  return rc;
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga4fa8573d9236d54687c61827ebf8cac0
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_dbi_put(MDB_txn* const txn,
+                  const MDB_dbi dbi,
+                  const MDB_val* const key,
+                  MDB_val* const data,
+                  const unsigned int flags = 0) noexcept {
+  LMDBXX_PROBE(put);
+  LMDBXX_PROBE_BYTES(key->mv_size + data->mv_size);
+  return ::mdb_put(txn, dbi, const_cast<MDB_val*>(key), data, flags);
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#gab8182f9360ea69ac0afd4a4eaab1ddb0
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_dbi_del(MDB_txn* const txn,
+                  const MDB_dbi dbi,
+                  const MDB_val* const key,
+                  const MDB_val* const data = nullptr) noexcept {
+  LMDBXX_PROBE(del);
+  LMDBXX_PROBE_BYTES(key->mv_size);
+  return ::mdb_del(txn, dbi, const_cast<MDB_val*>(key), const_cast<MDB_val*>(data));
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga48df35fb102536b32dfbb801a47b4cb0
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_cursor_get(MDB_cursor* const cursor,
+                     MDB_val* const key,
+                     MDB_val* const data,
+                     const MDB_cursor_op op) noexcept {
+  LMDBXX_PROBE(cursor_get);
+  const int rc = ::mdb_cursor_get(cursor, key, data, op);
+  LMDBXX_PROBE_BYTES(rc == MDB_SUCCESS
+                     ? key->mv_size + (data ? data->mv_size : 0) : 0);
+  return rc;
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga1f83ccb40011837ff37cc32be01ad91e
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_cursor_put(MDB_cursor* const cursor,
+                     MDB_val* const key,
+                     MDB_val* const data,
+                     const unsigned int flags = 0) noexcept {
+  LMDBXX_PROBE(cursor_put);
+  LMDBXX_PROBE_BYTES(key->mv_size + data->mv_size);
+  return ::mdb_cursor_put(cursor, key, data, flags);
+}
+
+/**
+ * @see http://symas.com/mdb/doc/group__mdb.html#ga26a52d3efcfd72e5bf6bd6960bf75f95
+ */
+static LMDBXX_FORCE_INLINE lmdb::status
+lmdb::try_cursor_del(MDB_cursor* const cursor,
+                     const unsigned int flags = 0) noexcept {
+  LMDBXX_PROBE(cursor_del);
+  return ::mdb_cursor_del(cursor, flags);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /* Resource Interface: Values */
 
@@ -1070,63 +1645,398 @@ static_assert(sizeof(lmdb::val) == sizeof(MDB_val), "sizeof(lmdb::val) != sizeof
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////
-/* Resource Interface: Environment */
+/* Resource Interface: Key Codecs */
 
 namespace lmdb {
-  class env;
+  template<typename T> struct key_int;
+  template<std::size_t N> struct key_fixed;
+  struct key_string;
+  template<std::size_t N> class key_buffer;
+  template<typename... Cs> struct key_codec;
 }
 
 /**
- * Resource class for `MDB_env*` handles.
- *
- * @note Instances of this class are movable, but not copyable.
- * @see http://symas.com/mdb/doc/group__internal.html#structMDB__env
+ * Key component of an integer type, encoded big-endian with the sign bit
+ * flipped so that the byte order of the encodings is numeric order.
  */
-class lmdb::env {
-protected:
-  MDB_env* _handle{nullptr};
+template<typename T>
+struct lmdb::key_int {
+  static_assert(std::is_integral<T>::value
+                && sizeof(T) <= sizeof(unsigned long long),
+                "T must be an integer type");
 
-public:
-  static constexpr unsigned int default_flags = 0;
-  static constexpr mode default_mode = 0644; /* -rw-r--r-- */
+  using value_type = T;
+  static constexpr std::size_t fixed_size = sizeof(T);
 
   /**
-   * Creates a new LMDB environment.
+   * Encodes a value into `room` bytes at `out`, unless they are too few.
    *
-   * @param flags
-   * @throws lmdb::error on failure
-   */
-  static env create(const unsigned int flags = default_flags) {
-    MDB_env* handle{nullptr};
-    lmdb::env_create(&handle);
-#ifdef LMDBXX_DEBUG
-    assert(handle != nullptr);
-#endif
-    if (flags) {
-      try {
-        lmdb::env_set_flags(handle, flags);
-      }
-      catch (const lmdb::error&) {
-        lmdb::env_close(handle);
-        throw;
+   * @return the size of the encoding
+   */
+  static std::size_t encode(const T value,
+                            char* const out,
+                            const std::size_t room) noexcept {
+    if (room >= sizeof(T)) {
+      unsigned long long u = flip(static_cast<unsigned_type>(value));
+      for (std::size_t i = sizeof(T); i-- > 0; u >>= 8) {
+        out[i] = static_cast<char>(u & 0xff);
       }
     }
-    return env{handle};
+    return sizeof(T);
   }
 
   /**
-   * Constructor.
+   * Decodes a value at `p` and moves `p` past it.
    *
-   * @param handle a valid `MDB_env*` handle
+   * @return false if the bytes up to `end` hold no value
    */
-  env(MDB_env* const handle) noexcept
-    : _handle{handle} {}
+  static bool decode(const char*& p,
+                     const char* const end,
+                     T& value) noexcept {
+    if (static_cast<std::size_t>(end - p) < sizeof(T)) {
+      return false;
+    }
+    unsigned long long u{0};
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+      u = (u << 8) | static_cast<unsigned char>(p[i]);
+    }
+    value = static_cast<T>(flip(static_cast<unsigned_type>(u)));
+    p += sizeof(T);
+    return true;
+  }
 
-  /**
-   * Move constructor.
-   */
-  env(env&& other) noexcept {
-    std::swap(_handle, other._handle);
+private:
+  using unsigned_type = typename std::make_unsigned<T>::type;
+
+  static unsigned_type flip(const unsigned_type u) noexcept {
+    return std::is_signed<T>::value
+      ? static_cast<unsigned_type>(u ^ (1ULL << (8 * sizeof(T) - 1)))
+      : u;
+  }
+};
+
+/**
+ * Key component of a string of `N` bytes. Shorter strings are padded with
+ * zero bytes, which decoding strips again.
+ */
+template<std::size_t N>
+struct lmdb::key_fixed {
+  static_assert(N > 0, "N must not be zero");
+
+  using value_type = std::string;
+  static constexpr std::size_t fixed_size = N;
+
+  /**
+   * Encodes a string into `room` bytes at `out`, unless they are too few.
+   *
+   * @return the size of the encoding
+   * @throws lmdb::error if the string is longer than `N` bytes
+   */
+  static std::size_t encode(const char* const data,
+                            const std::size_t size,
+                            char* const out,
+                            const std::size_t room) {
+    if (size > N) {
+      error::raise("key_fixed", MDB_BAD_VALSIZE);
+    }
+    if (room >= N) {
+      std::memcpy(out, data, size);
+      std::memset(out + size, 0, N - size);
+    }
+    return N;
+  }
+
+  static std::size_t encode(const std::string& value,
+                            char* const out,
+                            const std::size_t room) {
+    return encode(value.data(), value.size(), out, room);
+  }
+
+  static std::size_t encode(const char* const value,
+                            char* const out,
+                            const std::size_t room) {
+    return encode(value, std::strlen(value), out, room);
+  }
+
+  /**
+   * Decodes a string at `p` and moves `p` past it.
+   *
+   * @return false if the bytes up to `end` hold no string
+   */
+  static bool decode(const char*& p,
+                     const char* const end,
+                     std::string& value) {
+    if (static_cast<std::size_t>(end - p) < N) {
+      return false;
+    }
+    std::size_t size{N};
+    while (size > 0 && p[size - 1] == '\0') {
+      --size;
+    }
+    value.assign(p, size);
+    p += N;
+    return true;
+  }
+};
+
+/**
+ * Key component of a string of any length. Zero bytes are escaped as
+ * `00 FF` and the string ends with `00 01`, so that a string sorts before
+ * its extensions and the components after it do not affect the order.
+ */
+struct lmdb::key_string {
+  using value_type = std::string;
+  static constexpr std::size_t fixed_size = 0;
+
+  /**
+   * Encodes a string into `room` bytes at `out`, unless they are too few.
+   *
+   * @return the size of the encoding
+   */
+  static std::size_t encode(const char* const data,
+                            const std::size_t size,
+                            char* const out,
+                            const std::size_t room) noexcept {
+    std::size_t n{size + 2};
+    for (std::size_t i = 0; i < size; ++i) {
+      n += (data[i] == '\0');
+    }
+    if (room >= n) {
+      char* q = out;
+      for (std::size_t i = 0; i < size; ++i) {
+        *q++ = data[i];
+        if (data[i] == '\0') {
+          *q++ = '\xff';
+        }
+      }
+      *q++ = '\0';
+      *q = '\x01';
+    }
+    return n;
+  }
+
+  static std::size_t encode(const std::string& value,
+                            char* const out,
+                            const std::size_t room) noexcept {
+    return encode(value.data(), value.size(), out, room);
+  }
+
+  static std::size_t encode(const char* const value,
+                            char* const out,
+                            const std::size_t room) noexcept {
+    return encode(value, std::strlen(value), out, room);
+  }
+
+  /**
+   * Decodes a string at `p` and moves `p` past it.
+   *
+   * @return false if the bytes up to `end` hold no string
+   */
+  static bool decode(const char*& p,
+                     const char* const end,
+                     std::string& value) {
+    value.clear();
+    for (const char* q = p; q < end; ++q) {
+      if (*q != '\0') {
+        continue;
+      }
+      if (end - q < 2 || (q[1] != '\x01' && q[1] != '\xff')) {
+        return false;
+      }
+      value.append(p, q - p);
+      p = q + 2;
+      if (q[1] == '\x01') {
+        return true;
+      }
+      value += '\0';
+      q = p - 1;
+    }
+    return false;
+  }
+};
+
+/**
+ * Stack buffer of an encoded key of at most `N` bytes.
+ */
+template<std::size_t N>
+class lmdb::key_buffer {
+  char _data[N];
+  std::size_t _size{0};
+
+public:
+  static constexpr std::size_t capacity = N;
+
+  char* data() noexcept {
+    return _data;
+  }
+
+  const char* data() const noexcept {
+    return _data;
+  }
+
+  std::size_t size() const noexcept {
+    return _size;
+  }
+
+  void resize(const std::size_t size) noexcept {
+    _size = size;
+  }
+
+  /**
+   * Returns the encoded key.
+   */
+  lmdb::val val() const noexcept {
+    return lmdb::val{_data, _size};
+  }
+};
+
+/**
+ * Codec of the empty key, which ends the component recursion.
+ */
+template<>
+struct lmdb::key_codec<> {
+  static constexpr bool is_fixed = true;
+  static constexpr std::size_t fixed_size = 0;
+
+  static std::size_t encode_to(char*, std::size_t) noexcept {
+    return 0;
+  }
+
+  static bool decode_from(const char*& p, const char* const end) noexcept {
+    return p == end;
+  }
+};
+
+/**
+ * Codec of keys composed of the components `Cs...` (`lmdb::key_int<T>`,
+ * `lmdb::key_fixed<N>` and `lmdb::key_string`), whose encodings compare
+ * with `memcmp()` like the tuples of their values. Encoding the leading
+ * components only yields the prefix shared by the keys that start with
+ * them. Neither encoding nor decoding allocates, except for decoded
+ * strings.
+ *
+ * Example:
+ *
+ *     using codec = lmdb::key_codec<lmdb::key_string, lmdb::key_int<int64_t>,
+ *                                   lmdb::key_int<uint32_t>>;
+ *     lmdb::key_buffer<64> key;
+ *     codec::encode(key, "acme", timestamp, id);
+ */
+template<typename C, typename... Cs>
+struct lmdb::key_codec<C, Cs...> {
+  /** Whether all keys have the same size, `fixed_size`. */
+  static constexpr bool is_fixed =
+    C::fixed_size > 0 && key_codec<Cs...>::is_fixed;
+  static constexpr std::size_t fixed_size =
+    is_fixed ? C::fixed_size + key_codec<Cs...>::fixed_size : 0;
+
+  /**
+   * Encodes the leading components into a buffer.
+   *
+   * @throws lmdb::error if the encoding does not fit
+   */
+  template<std::size_t N, typename... As>
+  static void encode(lmdb::key_buffer<N>& key,
+                     const As&... values) {
+    static_assert(sizeof...(As) <= 1 + sizeof...(Cs), "too many components");
+    key.resize(encode_to(key.data(), N, values...));
+  }
+
+  /**
+   * Decodes all components of a key.
+   *
+   * @return false if the key is not an encoding of all components
+   */
+  static bool decode(const MDB_val& key,
+                     typename C::value_type& value,
+                     typename Cs::value_type&... values) {
+    const char* p = static_cast<const char*>(key.mv_data);
+    return decode_from(p, p + key.mv_size, value, values...);
+  }
+
+  static std::size_t encode_to(char*, std::size_t) noexcept {
+    return 0;
+  }
+
+  template<typename A, typename... As>
+  static std::size_t encode_to(char* const out,
+                               const std::size_t room,
+                               const A& value,
+                               const As&... values) {
+    const std::size_t n = C::encode(value, out, room);
+    if (n > room) {
+      error::raise("key_codec", MDB_BAD_VALSIZE);
+    }
+    return n + key_codec<Cs...>::encode_to(out + n, room - n, values...);
+  }
+
+  static bool decode_from(const char*& p,
+                          const char* const end,
+                          typename C::value_type& value,
+                          typename Cs::value_type&... values) {
+    return C::decode(p, end, value)
+      && key_codec<Cs...>::decode_from(p, end, values...);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Environment */
+
+namespace lmdb {
+  class env;
+}
+
+/**
+ * Resource class for `MDB_env*` handles.
+ *
+ * @note Instances of this class are movable, but not copyable.
+ * @see http://symas.com/mdb/doc/group__internal.html#structMDB__env
+ */
+class lmdb::env {
+protected:
+  MDB_env* _handle{nullptr};
+
+public:
+  static constexpr unsigned int default_flags = 0;
+  static constexpr mode default_mode = 0644; /* -rw-r--r-- */
+
+  /**
+   * Creates a new LMDB environment.
+   *
+   * @param flags
+   * @throws lmdb::error on failure
+   */
+  static env create(const unsigned int flags = default_flags) {
+    MDB_env* handle{nullptr};
+    lmdb::env_create(&handle);
+#ifdef LMDBXX_DEBUG
+    assert(handle != nullptr);
+#endif
+    if (flags) {
+      try {
+        lmdb::env_set_flags(handle, flags);
+      }
+      catch (const lmdb::error&) {
+        lmdb::env_close(handle);
+        throw;
+      }
+    }
+    return env{handle};
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param handle a valid `MDB_env*` handle
+   */
+  env(MDB_env* const handle) noexcept
+    : _handle{handle} {}
+
+  /**
+   * Move constructor.
+   */
+  env(env&& other) noexcept {
+    std::swap(_handle, other._handle);
   }
 
   /**
@@ -1701,117 +2611,412 @@ public:
 };
 
 ////////////////////////////////////////////////////////////////////////////////
-/* Resource Interface: Cursors */
+/* Resource Interface: Cursor Ranges */
 
 namespace lmdb {
-  class cursor;
+  class range;
 }
 
 /**
- * Resource class for `MDB_cursor*` handles.
+ * Input range over the key/value pairs of a cursor, for use in range-based
+ * `for` loops.
  *
- * @note Instances of this class are movable, but not copyable.
- * @see http://symas.com/mdb/doc/group__internal.html#structMDB__cursor
+ * The pairs point into the memory map without copying, and stay valid
+ * until the transaction ends or, in a read-write transaction, the database
+ * is changed. Keys are visited in database order or in reverse. The key
+ * bounds are compared with `mdb_cmp()`, so a custom comparator is honored;
+ * a prefix is matched bytewise.
+ *
+ * @note Instances of this class are copyable. Iterating a range moves the
+ *       cursor it was created from.
  */
-class lmdb::cursor {
-protected:
-  MDB_cursor* _handle{nullptr};
-
+class lmdb::range {
 public:
-  static constexpr unsigned int default_flags = 0;
-
   /**
-   * Creates an LMDB cursor.
-   *
-   * @param txn the transaction handle
-   * @param dbi the database handle
-   * @throws lmdb::error on failure
+   * Key/value pair pointing into the memory map.
    */
-  static cursor
-  open(MDB_txn* const txn,
-       const MDB_dbi dbi) {
-    MDB_cursor* handle{};
-    lmdb::cursor_open(txn, dbi, &handle);
-#ifdef LMDBXX_DEBUG
-    assert(handle != nullptr);
-#endif
-    return cursor{handle};
-  }
+  struct entry {
+    lmdb::val key;
+    lmdb::val value;
 
-  /**
-   * Constructor.
-   *
-   * @param handle a valid `MDB_cursor*` handle
-   */
-  cursor(MDB_cursor* const handle) noexcept
-    : _handle{handle} {}
+    entry() noexcept = default;
+
+    entry(const entry& other) noexcept
+      : key{other.key.data(), other.key.size()},
+        value{other.value.data(), other.value.size()} {}
+
+    entry& operator=(const entry& other) noexcept {
+      key.assign(other.key.data(), other.key.size());
+      value.assign(other.value.data(), other.value.size());
+      return *this;
+    }
+  };
 
   /**
-   * Move constructor.
+   * Input iterator over a range; the end iterator is default-constructed.
    */
-  cursor(cursor&& other) noexcept {
-    std::swap(_handle, other._handle);
+  class iterator {
+    const range* _range{nullptr};
+    entry _entry{};
+
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type        = entry;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const entry*;
+    using reference         = const entry&;
+
+    iterator() noexcept = default;
+
+    /**
+     * Positions the cursor at the first pair of the range.
+     *
+     * @throws lmdb::error on failure
+     */
+    explicit iterator(const range* const r)
+      : _range{r} {
+      if (!_range->first(_entry)) _range = nullptr;
+    }
+
+    reference operator*() const noexcept {
+      return _entry;
+    }
+
+    pointer operator->() const noexcept {
+      return &_entry;
+    }
+
+    /**
+     * @throws lmdb::error on failure
+     */
+    iterator& operator++() {
+      if (!_range->next(_entry)) _range = nullptr;
+      return *this;
+    }
+
+    bool operator==(const iterator& other) const noexcept {
+      return _range == other._range;
+    }
+
+    bool operator!=(const iterator& other) const noexcept {
+      return _range != other._range;
+    }
+  };
+
+protected:
+  MDB_cursor* _cursor;
+  std::string _lo;
+  std::string _hi;
+  std::string _prefix;
+  bool _has_lo{false};
+  bool _has_hi{false};
+  bool _reverse{false};
+
+  int compare(const lmdb::val& key,
+              const std::string& bound) const noexcept {
+    const MDB_val b{bound.size(), const_cast<char*>(bound.data())};
+    return ::mdb_cmp(lmdb::cursor_txn(_cursor), lmdb::cursor_dbi(_cursor),
+                     key, &b);
+  }
+
+  bool within(const lmdb::val& key) const noexcept {
+    if (key.size() < _prefix.size()
+        || std::memcmp(key.data(), _prefix.data(), _prefix.size()) != 0) {
+      return false;
+    }
+    if (_reverse) {
+      return !_has_lo || compare(key, _lo) >= 0;
+    }
+    return !_has_hi || compare(key, _hi) < 0;
   }
 
-  /**
-   * Move assignment operator.
-   */
-  cursor& operator=(cursor&& other) noexcept {
-    if (this != &other) {
-      std::swap(_handle, other._handle);
+  bool seek(entry& e,
+            const std::string& key,
+            const MDB_cursor_op op) const {
+    e.key.assign(key);
+    return lmdb::cursor_get(_cursor, e.key, e.value, op);
+  }
+
+  bool first(entry& e) const {
+    bool found;
+    if (!_reverse) {
+      // the larger of the lower bound and the prefix
+      const std::string* start = _has_lo ? &_lo : nullptr;
+      if (!_prefix.empty()
+          && (!start || compare(lmdb::val{_prefix}, _lo) > 0)) {
+        start = &_prefix;
+      }
+      found = start ? seek(e, *start, MDB_SET_RANGE)
+                    : lmdb::cursor_get(_cursor, e.key, e.value, MDB_FIRST);
+    } else {
+      // the last key before the upper bound or the keys with the prefix
+      std::string end = _prefix;
+      while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) {
+        end.pop_back();
+      }
+      if (!end.empty()) ++end.back();
+      const std::string* stop = end.empty() ? nullptr : &end;
+      if (_has_hi && (!stop || compare(lmdb::val{_hi}, end) < 0)) {
+        stop = &_hi;
+      }
+      found = stop && seek(e, *stop, MDB_SET_RANGE)
+        ? lmdb::cursor_get(_cursor, e.key, e.value, MDB_PREV)
+        : lmdb::cursor_get(_cursor, e.key, e.value, MDB_LAST);
     }
-    return *this;
+    return found && within(e.key);
   }
 
-  /**
-   * Destructor.
-   */
-  ~cursor() noexcept {
-    try { close(); } catch (...) {}
+  bool next(entry& e) const {
+    return lmdb::cursor_get(_cursor, e.key, e.value,
+                            _reverse ? MDB_PREV : MDB_NEXT)
+      && within(e.key);
   }
 
+public:
   /**
-   * Returns the underlying `MDB_cursor*` handle.
+   * Constructor.
+   *
+   * @param cursor a valid `MDB_cursor*` handle
    */
-  operator MDB_cursor*() const noexcept {
-    return _handle;
-  }
+  explicit range(MDB_cursor* const cursor) noexcept
+    : _cursor{cursor} {}
 
   /**
-   * Returns the underlying `MDB_cursor*` handle.
+   * Returns this range limited to keys not less than `key`.
    */
-  MDB_cursor* handle() const noexcept {
-    return _handle;
+  range from(const lmdb::val& key) const {
+    range r{*this};
+    r._lo.assign(key.data(), key.size());
+    r._has_lo = true;
+    return r;
   }
 
   /**
-   * Closes this cursor.
-   *
-   * @note this method is idempotent
-   * @post `handle() == nullptr`
+   * Returns this range limited to keys less than `key`.
    */
-  void close() noexcept {
-    if (_handle) {
-      lmdb::cursor_close(_handle);
-      _handle = nullptr;
-    }
+  range until(const lmdb::val& key) const {
+    range r{*this};
+    r._hi.assign(key.data(), key.size());
+    r._has_hi = true;
+    return r;
   }
 
   /**
-   * Renews this cursor.
-   *
-   * @param txn the transaction scope
-   * @throws lmdb::error on failure
+   * Returns this range limited to keys starting with `prefix`.
    */
-  void renew(MDB_txn* const txn) {
-    lmdb::cursor_renew(txn, handle());
+  range with_prefix(const lmdb::val& prefix) const {
+    range r{*this};
+    r._prefix.assign(prefix.data(), prefix.size());
+    return r;
   }
 
   /**
-   * Returns the cursor's transaction handle.
+   * Returns this range visited in reverse key order.
    */
-  MDB_txn* txn() const noexcept {
-    return lmdb::cursor_txn(handle());
+  range reverse() const {
+    range r{*this};
+    r._reverse = !r._reverse;
+    return r;
+  }
+
+  /**
+   * Positions the cursor at the first pair of the range.
+   *
+   * @throws lmdb::error on failure
+   */
+  iterator begin() const {
+    return iterator{this};
+  }
+
+  iterator end() const noexcept {
+    return iterator{};
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Duplicate Spans */
+
+namespace lmdb {
+  template<typename T> class dup_span;
+}
+
+/**
+ * Contiguous run of fixed-size duplicates of one key, as returned a page
+ * at a time by `MDB_GET_MULTIPLE` and `MDB_NEXT_MULTIPLE` from an
+ * `MDB_DUPFIXED` database.
+ *
+ * @note The elements point into the database map and stay valid only
+ *       until the end of the transaction or the next update. LMDB does
+ *       not align them, so a `T` that needs alignment must be copied out.
+ */
+template<typename T>
+class lmdb::dup_span {
+  static_assert(std::is_pod<T>::value, "duplicates must be a POD type");
+
+  const T* _data{nullptr};
+  std::size_t _size{0};
+
+public:
+  using value_type = T;
+  using const_iterator = const T*;
+
+  dup_span() noexcept = default;
+
+  /**
+   * Constructor.
+   *
+   * @param val a page of duplicates returned by `mdb_cursor_get()`
+   */
+  explicit dup_span(const MDB_val& val) noexcept
+    : _data{static_cast<const T*>(val.mv_data)},
+      _size{val.mv_size / sizeof(T)} {}
+
+  /**
+   * Returns a pointer to the first duplicate.
+   */
+  const T* data() const noexcept {
+    return _data;
+  }
+
+  /**
+   * Returns the number of duplicates.
+   */
+  std::size_t size() const noexcept {
+    return _size;
+  }
+
+  /**
+   * Determines whether the span is empty.
+   */
+  bool empty() const noexcept {
+    return _size == 0;
+  }
+
+  const T& operator[](const std::size_t i) const noexcept {
+    return _data[i];
+  }
+
+  const T* begin() const noexcept {
+    return _data;
+  }
+
+  const T* end() const noexcept {
+    return _data + _size;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Cursors */
+
+namespace lmdb {
+  class cursor;
+}
+
+/**
+ * Resource class for `MDB_cursor*` handles.
+ *
+ * @note Instances of this class are movable, but not copyable.
+ * @see http://symas.com/mdb/doc/group__internal.html#structMDB__cursor
+ */
+class lmdb::cursor {
+protected:
+  MDB_cursor* _handle{nullptr};
+
+public:
+  static constexpr unsigned int default_flags = 0;
+
+  /**
+   * Creates an LMDB cursor.
+   *
+   * @param txn the transaction handle
+   * @param dbi the database handle
+   * @throws lmdb::error on failure
+   */
+  static cursor
+  open(MDB_txn* const txn,
+       const MDB_dbi dbi) {
+    MDB_cursor* handle{};
+    lmdb::cursor_open(txn, dbi, &handle);
+#ifdef LMDBXX_DEBUG
+    assert(handle != nullptr);
+#endif
+    return cursor{handle};
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param handle a valid `MDB_cursor*` handle
+   */
+  cursor(MDB_cursor* const handle) noexcept
+    : _handle{handle} {}
+
+  /**
+   * Move constructor.
+   */
+  cursor(cursor&& other) noexcept {
+    std::swap(_handle, other._handle);
+  }
+
+  /**
+   * Move assignment operator.
+   */
+  cursor& operator=(cursor&& other) noexcept {
+    if (this != &other) {
+      std::swap(_handle, other._handle);
+    }
+    return *this;
+  }
+
+  /**
+   * Destructor.
+   */
+  ~cursor() noexcept {
+    try { close(); } catch (...) {}
+  }
+
+  /**
+   * Returns the underlying `MDB_cursor*` handle.
+   */
+  operator MDB_cursor*() const noexcept {
+    return _handle;
+  }
+
+  /**
+   * Returns the underlying `MDB_cursor*` handle.
+   */
+  MDB_cursor* handle() const noexcept {
+    return _handle;
+  }
+
+  /**
+   * Closes this cursor.
+   *
+   * @note this method is idempotent
+   * @post `handle() == nullptr`
+   */
+  void close() noexcept {
+    if (_handle) {
+      lmdb::cursor_close(_handle);
+      _handle = nullptr;
+    }
+  }
+
+  /**
+   * Renews this cursor.
+   *
+   * @param txn the transaction scope
+   * @throws lmdb::error on failure
+   */
+  void renew(MDB_txn* const txn) {
+    lmdb::cursor_renew(txn, handle());
+  }
+
+  /**
+   * Returns the cursor's transaction handle.
+   */
+  MDB_txn* txn() const noexcept {
+    return lmdb::cursor_txn(handle());
   }
 
   /**
@@ -1906,6 +3111,745 @@ public:
     lmdb::val k{&key, sizeof(K)};
     return get(k, nullptr, op);
   }
+
+  /**
+   * Retrieves a page of the fixed-size duplicates of an `MDB_DUPFIXED`
+   * database: `MDB_GET_MULTIPLE` returns the duplicates from the current
+   * position of this cursor, `MDB_NEXT_MULTIPLE` those of the next page of
+   * the same key.
+   *
+   * @param values
+   * @param op `MDB_GET_MULTIPLE` or `MDB_NEXT_MULTIPLE`
+   * @retval false if there is no page, as for a key with a single value,
+   *         for which `MDB_GET_MULTIPLE` succeeds without returning it
+   * @throws lmdb::error on failure
+   */
+  template<typename T>
+  bool get_multiple(lmdb::dup_span<T>& values,
+                    const MDB_cursor_op op = MDB_NEXT_MULTIPLE) {
+    MDB_val k{}, v{};
+    if (!get(&k, &v, op) || v.mv_data == nullptr) {
+      return false;
+    }
+    if (v.mv_size % sizeof(T) != 0) {
+      error::raise("mdb_cursor_get", MDB_BAD_VALSIZE);
+    }
+    values = lmdb::dup_span<T>{v};
+    return true;
+  }
+
+  /**
+   * Calls `f` with each page of the fixed-size duplicates of a key of an
+   * `MDB_DUPFIXED` database, in their sort order.
+   *
+   * @param key
+   * @param f called with an `lmdb::dup_span<T>`
+   * @return the number of duplicates
+   * @throws lmdb::error on failure
+   */
+  template<typename T, typename F>
+  std::size_t for_each_multiple(const lmdb::val& key,
+                                F&& f) {
+    MDB_val k{key.size(), const_cast<char*>(key.data())}, v{};
+    if (!get(&k, &v, MDB_SET)) {
+      return 0;
+    }
+    lmdb::dup_span<T> values;
+    if (!get_multiple(values, MDB_GET_MULTIPLE)) {
+      // the single value of the key is the one `MDB_SET` returned
+      if (v.mv_size != sizeof(T)) {
+        error::raise("mdb_cursor_get", MDB_BAD_VALSIZE);
+      }
+      values = lmdb::dup_span<T>{v};
+      f(values);
+      return 1;
+    }
+    std::size_t count{0};
+    do {
+      count += values.size();
+      f(values);
+    } while (get_multiple(values, MDB_NEXT_MULTIPLE));
+    return count;
+  }
+
+  /**
+   * Stores fixed-size duplicates of a key of an `MDB_DUPFIXED` database
+   * with a single `MDB_MULTIPLE` put.
+   *
+   * @param key
+   * @param values the duplicates
+   * @param count the number of duplicates
+   * @param flags other `mdb_cursor_put()` flags, e.g. `MDB_NODUPDATA`
+   * @return the number of duplicates stored
+   * @throws lmdb::error on failure
+   */
+  template<typename T>
+  std::size_t put_multiple(const lmdb::val& key,
+                           const T* const values,
+                           const std::size_t count,
+                           const unsigned int flags = 0) {
+    static_assert(std::is_pod<T>::value, "duplicates must be a POD type");
+    if (count == 0) {
+      return 0;
+    }
+    MDB_val k{key.size(), const_cast<char*>(key.data())};
+    MDB_val v[2] = {{sizeof(T), const_cast<T*>(values)}, {count, nullptr}};
+    lmdb::cursor_put(handle(), &k, v, flags | MDB_MULTIPLE);
+    return v[1].mv_size;
+  }
+
+  /**
+   * Returns the range of all key/value pairs.
+   */
+  lmdb::range range() const noexcept {
+    return lmdb::range{handle()};
+  }
+
+  /**
+   * Returns the range of key/value pairs with keys in [`lo`, `hi`).
+   */
+  lmdb::range range(const lmdb::val& lo,
+                    const lmdb::val& hi) const {
+    return range().from(lo).until(hi);
+  }
+
+  /**
+   * Returns the range of key/value pairs with keys not less than `key`.
+   */
+  lmdb::range range_from(const lmdb::val& key) const {
+    return range().from(key);
+  }
+
+  /**
+   * Returns the range of key/value pairs with keys starting with `prefix`.
+   */
+  lmdb::range prefix(const lmdb::val& prefix) const {
+    return range().with_prefix(prefix);
+  }
+
+  /**
+   * Returns the range of all key/value pairs in reverse key order.
+   */
+  lmdb::range reverse() const {
+    return range().reverse();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Transaction Pools */
+
+namespace lmdb {
+  class txn_pool;
+}
+
+/**
+ * Thread-safe pool of read-only transactions of one environment.
+ *
+ * Released transactions are reset and kept; acquiring one renews an idle
+ * transaction onto the latest snapshot, which reuses its reader slot
+ * instead of setting up a new one as `mdb_txn_begin()` does. Cursors kept
+ * across acquisitions are moved onto a snapshot with `renew()`.
+ *
+ * @note Instances of this class are neither movable nor copyable. A
+ *       snapshot may be used by a thread other than the one that began it
+ *       only if the environment was opened with `MDB_NOTLS`.
+ */
+class lmdb::txn_pool {
+public:
+  static constexpr std::size_t default_capacity = 64;
+
+  /**
+   * Read-only transaction borrowed from a pool, returned to it on
+   * destruction.
+   *
+   * @note Instances of this class are movable, but not copyable.
+   */
+  class snapshot {
+    txn_pool* _pool{nullptr};
+    MDB_txn* _handle{nullptr};
+
+  public:
+    snapshot() noexcept = default;
+
+    snapshot(txn_pool& pool, MDB_txn* const handle) noexcept
+      : _pool{&pool}, _handle{handle} {}
+
+    snapshot(snapshot&& other) noexcept {
+      std::swap(_pool, other._pool);
+      std::swap(_handle, other._handle);
+    }
+
+    snapshot& operator=(snapshot&& other) noexcept {
+      if (this != &other) {
+        std::swap(_pool, other._pool);
+        std::swap(_handle, other._handle);
+      }
+      return *this;
+    }
+
+    ~snapshot() noexcept {
+      release();
+    }
+
+    /**
+     * Returns the underlying `MDB_txn*` handle.
+     */
+    operator MDB_txn*() const noexcept {
+      return _handle;
+    }
+
+    /**
+     * Returns the underlying `MDB_txn*` handle.
+     */
+    MDB_txn* handle() const noexcept {
+      return _handle;
+    }
+
+    /**
+     * Moves this transaction onto the latest snapshot.
+     *
+     * @throws lmdb::error on failure
+     */
+    void refresh() {
+      lmdb::txn_reset(_handle);
+      lmdb::txn_renew(_handle);
+    }
+
+    /**
+     * Renews a cursor opened in an earlier transaction of the same
+     * environment onto this one.
+     *
+     * @param cursor a cursor of a read-only transaction
+     * @throws lmdb::error on failure
+     */
+    void renew(lmdb::cursor& cursor) const {
+      cursor.renew(_handle);
+    }
+
+    /**
+     * Returns this transaction to its pool.
+     *
+     * @note this method is idempotent
+     * @post `handle() == nullptr`
+     */
+    void release() noexcept {
+      if (_handle) {
+        _pool->release(_handle);
+        _handle = nullptr;
+      }
+    }
+  };
+
+  /**
+   * Constructor.
+   *
+   * @param env      the environment handle
+   * @param capacity the number of idle transactions kept at most
+   */
+  explicit txn_pool(MDB_env* const env,
+                    const std::size_t capacity = default_capacity)
+    : _env{env}, _capacity{capacity} {}
+
+  txn_pool(const txn_pool&) = delete;
+  txn_pool& operator=(const txn_pool&) = delete;
+
+  /**
+   * Destructor. Aborts the idle transactions; every snapshot must have
+   * been released before.
+   */
+  ~txn_pool() noexcept {
+    for (MDB_txn* const txn : _idle) {
+      lmdb::txn_abort(txn);
+    }
+  }
+
+  /**
+   * Returns the pool's `MDB_env*` handle.
+   */
+  MDB_env* env() const noexcept {
+    return _env;
+  }
+
+  /**
+   * Returns a read-only transaction on the latest snapshot, renewing an
+   * idle one if there is any.
+   *
+   * @throws lmdb::error on failure
+   */
+  snapshot acquire() {
+    MDB_txn* handle{nullptr};
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (!_idle.empty()) {
+        handle = _idle.back();
+        _idle.pop_back();
+      }
+    }
+    if (handle) {
+      try {
+        lmdb::txn_renew(handle);
+      }
+      catch (...) {
+        lmdb::txn_abort(handle);
+        throw;
+      }
+    } else {
+      lmdb::txn_begin(_env, nullptr, MDB_RDONLY, &handle);
+    }
+    return snapshot{*this, handle};
+  }
+
+  /**
+   * Resets a read-only transaction of this pool and keeps it for reuse,
+   * or aborts it when the pool is full.
+   */
+  void release(MDB_txn* const handle) noexcept {
+    lmdb::txn_reset(handle);
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      if (_idle.size() < _capacity) {
+        try {
+          _idle.push_back(handle);
+          return;
+        }
+        catch (...) {}
+      }
+    }
+    lmdb::txn_abort(handle);
+  }
+
+  /**
+   * Returns the number of idle transactions.
+   */
+  std::size_t idle() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _idle.size();
+  }
+
+private:
+  MDB_env* const _env;
+  const std::size_t _capacity;
+  std::mutex _mutex;
+  std::vector<MDB_txn*> _idle;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/* Resource Interface: Batch Writers */
+
+namespace lmdb {
+  class batch_writer;
+}
+
+/**
+ * Buffered writer of one database that owns its write transactions.
+ *
+ * Puts and deletes are copied into an arena and written in runs: each run
+ * is stably sorted by key, so that the operations on a key keep their
+ * order, and applied to the open transaction once its keys and values
+ * take the byte limit, on `flush()`, or when the transaction commits.
+ * Puts of keys past the last key of the database use `MDB_APPEND`. The
+ * transaction commits on `commit()`, or when its batch reaches the entry
+ * or time limit; neither is set by default, so that all operations are
+ * committed together. On `MDB_MAP_FULL` the map size is doubled and the
+ * run replayed, unless runs written before it have left the arena: a
+ * batch to be replayed must stay below the byte limit.
+ *
+ * @note Instances of this class are movable, but not copyable. Operations
+ *       not yet flushed are discarded on destruction, as is an uncommitted
+ *       `lmdb::txn`.
+ */
+class lmdb::batch_writer {
+public:
+  static constexpr std::size_t default_batch_bytes = 64UL << 20;
+
+  using clock = std::chrono::steady_clock;
+
+protected:
+  struct op {
+    std::size_t offset;
+    std::size_t key_size;
+    std::size_t data_size;
+    unsigned int flags;
+    bool del;
+  };
+
+  MDB_env* _env{nullptr};
+  MDB_txn* _txn{nullptr};
+  MDB_dbi _dbi{0};
+  MDB_cmp_func* _cmp{nullptr};
+  bool _append{true};
+  std::vector<char> _arena;
+  std::vector<op> _ops;
+  std::size_t _batch_entries{0};
+  std::size_t _batch_bytes{default_batch_bytes};
+  clock::duration _batch_interval{clock::duration::zero()};
+  clock::time_point _batch_start;
+  bool _written{false};  // the open transaction holds runs already written
+  std::size_t _batch_size{0};  // operations since the last commit
+  std::function<void(const MDB_val&)> _on_exist;
+  std::function<void()> _on_commit;
+
+  MDB_val key_of(const op& o) const noexcept {
+    return MDB_val{o.key_size, const_cast<char*>(_arena.data() + o.offset)};
+  }
+
+  MDB_val data_of(const op& o) const noexcept {
+    return MDB_val{o.data_size,
+                   const_cast<char*>(_arena.data() + o.offset + o.key_size)};
+  }
+
+  void begin() {
+    lmdb::txn_begin(_env, nullptr, 0, &_txn);
+    if (_cmp) {
+      lmdb::dbi_set_compare(_txn, _dbi, _cmp);
+    }
+  }
+
+  void abort() noexcept {
+    if (_txn) {
+      lmdb::txn_abort(_txn);
+      _txn = nullptr;
+    }
+  }
+
+  void add(const MDB_val* const key,
+           const MDB_val* const data,
+           const unsigned int flags,
+           const bool del) {
+    if (_ops.empty() && !_written) _batch_start = clock::now();
+    const std::size_t offset = _arena.size();
+    const char* const k = static_cast<const char*>(key->mv_data);
+    _arena.insert(_arena.end(), k, k + key->mv_size);
+    if (data) {
+      const char* const d = static_cast<const char*>(data->mv_data);
+      _arena.insert(_arena.end(), d, d + data->mv_size);
+    }
+    _ops.push_back(op{offset, key->mv_size, data ? data->mv_size : 0,
+                      flags, del});
+    ++_batch_size;
+    if ((_batch_entries && _batch_size >= _batch_entries)
+        || (_batch_interval != clock::duration::zero()
+            && clock::now() - _batch_start >= _batch_interval)) {
+      commit();
+      begin();
+    } else if (_batch_bytes && _arena.size() >= _batch_bytes) {
+      write(false);
+    }
+  }
+
+  /**
+   * Applies the buffered operations to the open transaction, and commits
+   * it if `commit`. On `MDB_MAP_FULL` the map size is doubled and the
+   * operations replayed, unless the transaction holds runs written before.
+   *
+   * @throws lmdb::error on failure
+   */
+  void write(const bool commit) {
+    if (!_txn) begin();
+    std::vector<std::size_t> order(_ops.size());
+    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [this](const std::size_t a, const std::size_t b) {
+      const MDB_val x = key_of(_ops[a]);
+      const MDB_val y = key_of(_ops[b]);
+      return ::mdb_cmp(_txn, _dbi, &x, &y) < 0;
+    });
+    for (;;) {
+      lmdb::status rc = apply(order);
+      if (rc && commit) {
+        if (_on_commit) _on_commit();
+        MDB_txn* const txn = _txn;
+        _txn = nullptr;
+        rc = lmdb::try_txn_commit(txn);
+        if (!rc.map_full()) rc.check("mdb_txn_commit");
+      }
+      if (rc) break;
+      abort();  // a failed commit has already freed its transaction
+      if (_written) {  // the runs written before are gone with it
+        _written = false;
+        _batch_size = 0;
+        _arena.clear();
+        _ops.clear();
+        error::raise("mdb_put", MDB_MAP_FULL);
+      }
+      MDB_envinfo info;
+      lmdb::env_info(_env, &info);
+      lmdb::env_set_mapsize(_env, 2 * info.me_mapsize);
+      begin();
+    }
+    _written = !commit;
+    if (commit) _batch_size = 0;
+    _arena.clear();
+    _ops.clear();
+  }
+
+  /**
+   * Applies the sorted batch to the open transaction and reports the keys
+   * rejected by `MDB_NOOVERWRITE`.
+   *
+   * @return `MDB_MAP_FULL` if the batch does not fit the map
+   * @throws lmdb::error on other failures
+   */
+  lmdb::status apply(const std::vector<std::size_t>& order) {
+    std::string last_key;
+    MDB_val last{0, nullptr};
+    bool bounded = false;
+    if (_append) {
+      MDB_cursor* cursor{};
+      lmdb::cursor_open(_txn, _dbi, &cursor);
+      try {
+        bounded = lmdb::cursor_get(cursor, &last, nullptr, MDB_LAST);
+      }
+      catch (...) {
+        lmdb::cursor_close(cursor);
+        throw;
+      }
+      lmdb::cursor_close(cursor);
+      if (bounded) {  // the page may be copied by the puts that follow
+        last_key.assign(static_cast<const char*>(last.mv_data), last.mv_size);
+        last = MDB_val{last_key.size(), const_cast<char*>(last_key.data())};
+      }
+    }
+    for (const std::size_t i : order) {
+      const op& o = _ops[i];
+      const MDB_val key = key_of(o);
+      if (o.del) {
+        const lmdb::status rc = lmdb::try_dbi_del(_txn, _dbi, &key);
+        if (!rc && !rc.not_found()) {
+          if (rc.map_full()) return rc;
+          rc.check("mdb_del");
+        }
+        continue;
+      }
+      MDB_val data = data_of(o);
+      const bool append = _append
+        && (!bounded || ::mdb_cmp(_txn, _dbi, &key, &last) > 0);
+      const unsigned int flags = o.flags | (append ? MDB_APPEND : 0);
+      const lmdb::status rc = lmdb::try_dbi_put(_txn, _dbi, &key, &data, flags);
+      if (rc) {
+        if (append) {
+          last = key;
+          bounded = true;
+        }
+      } else if (rc.key_exist()) {
+        if (_on_exist) _on_exist(key);
+      } else {
+        if (rc.map_full()) return rc;
+        rc.check("mdb_put");
+      }
+    }
+    return MDB_SUCCESS;
+  }
+
+public:
+  /**
+   * Opens a database of an environment for batched writes.
+   *
+   * @param env the environment handle
+   * @param name the database name, or `nullptr` for the main database
+   * @param flags the `mdb_dbi_open()` flags
+   * @throws lmdb::error on failure
+   */
+  batch_writer(MDB_env* const env,
+               const char* const name = nullptr,
+               const unsigned int flags = 0)
+    : _env{env} {
+    begin();
+    try {
+      lmdb::dbi_open(_txn, name, flags, &_dbi);
+      unsigned int dbi_flags = 0;
+      lmdb::dbi_flags(_txn, _dbi, &dbi_flags);
+      _append = !(dbi_flags & MDB_DUPSORT);
+      if (name) {  // the handle of a named database outlives only a commit
+        MDB_txn* const txn = _txn;
+        _txn = nullptr;
+        lmdb::txn_commit(txn);
+        begin();
+      }
+    }
+    catch (...) {
+      abort();
+      throw;
+    }
+  }
+
+  /**
+   * Move constructor.
+   */
+  batch_writer(batch_writer&& other) noexcept
+    : _env{other._env},
+      _txn{other._txn},
+      _dbi{other._dbi},
+      _cmp{other._cmp},
+      _append{other._append},
+      _arena{std::move(other._arena)},
+      _ops{std::move(other._ops)},
+      _batch_entries{other._batch_entries},
+      _batch_bytes{other._batch_bytes},
+      _batch_interval{other._batch_interval},
+      _batch_start{other._batch_start},
+      _written{other._written},
+      _batch_size{other._batch_size},
+      _on_exist{std::move(other._on_exist)},
+      _on_commit{std::move(other._on_commit)} {
+    other._txn = nullptr;
+  }
+
+  batch_writer(const batch_writer&) = delete;
+  batch_writer& operator=(const batch_writer&) = delete;
+
+  /**
+   * Destructor.
+   */
+  ~batch_writer() noexcept {
+    abort();
+  }
+
+  /**
+   * Returns the open write transaction, which holds all flushed writes.
+   */
+  MDB_txn* txn() const noexcept {
+    return _txn;
+  }
+
+  /**
+   * Returns the database handle.
+   */
+  MDB_dbi dbi() const noexcept {
+    return _dbi;
+  }
+
+  /**
+   * Sets the key comparison function of the database, in this and every
+   * later transaction. It must be set before the first write.
+   *
+   * @throws lmdb::error on failure
+   */
+  void set_compare(MDB_cmp_func* const cmp) {
+    _cmp = cmp;
+    if (!_txn) {
+      begin();
+    } else if (_cmp) {
+      lmdb::dbi_set_compare(_txn, _dbi, _cmp);
+    }
+  }
+
+  /**
+   * Commits a batch after `count` operations; 0 sets no limit.
+   */
+  void set_batch_entries(const std::size_t count) noexcept {
+    _batch_entries = count;
+  }
+
+  /**
+   * Writes a run to the open transaction once its keys and values take
+   * `size` bytes; 0 sets no limit.
+   */
+  void set_batch_bytes(const std::size_t size) noexcept {
+    _batch_bytes = size;
+  }
+
+  /**
+   * Commits a batch at the first operation `interval` after its first
+   * one; zero sets no limit.
+   */
+  void set_batch_interval(const clock::duration interval) noexcept {
+    _batch_interval = interval;
+  }
+
+  /**
+   * Sets the function called with each key a put with `MDB_NOOVERWRITE`
+   * found already present.
+   */
+  void on_exist(std::function<void(const MDB_val&)> f) {
+    _on_exist = std::move(f);
+  }
+
+  /**
+   * Sets the function called before each commit, once the batch is
+   * written, e.g. to flush data the committed entries refer to.
+   */
+  void on_commit(std::function<void()> f) {
+    _on_commit = std::move(f);
+  }
+
+  /**
+   * Buffers a key/value pair to be stored.
+   *
+   * @param key
+   * @param data
+   * @param flags the `mdb_put()` flags
+   * @throws lmdb::error on failure of a batch this put completes
+   */
+  void put(const MDB_val* const key,
+           const MDB_val* const data,
+           const unsigned int flags = 0) {
+    add(key, data, flags, false);
+  }
+
+  /**
+   * Buffers the removal of a key.
+   *
+   * @param key
+   * @throws lmdb::error on failure of a batch this removal completes
+   */
+  void del(const MDB_val* const key) {
+    add(key, nullptr, 0, true);
+  }
+
+  /**
+   * Writes the buffered operations, if any, and returns the statistics of
+   * the database.
+   *
+   * @throws lmdb::error on failure
+   */
+  MDB_stat stat() {
+    if (!_ops.empty()) write(false);
+    MDB_stat result;
+    if (_txn) {
+      lmdb::dbi_stat(_txn, _dbi, &result);
+    } else {
+      MDB_txn* txn{nullptr};
+      lmdb::txn_begin(_env, nullptr, MDB_RDONLY, &txn);
+      try {
+        lmdb::dbi_stat(txn, _dbi, &result);
+      } catch (...) {
+        lmdb::txn_abort(txn);
+        throw;
+      }
+      lmdb::txn_abort(txn);
+    }
+    return result;
+  }
+
+  /**
+   * Returns the number of buffered operations.
+   */
+  std::size_t pending() const noexcept {
+    return _ops.size();
+  }
+
+  /**
+   * Writes the buffered operations to the open transaction without
+   * committing it.
+   *
+   * @throws lmdb::error on failure
+   */
+  void flush() {
+    if (!_ops.empty()) write(false);
+  }
+
+  /**
+   * Writes the buffered operations and commits the transaction; does
+   * nothing once they are committed and no transaction is open.
+   *
+   * @throws lmdb::error on failure
+   * @post `txn() == nullptr`
+   */
+  void commit() {
+    if (!_txn && _ops.empty()) return;
+    write(true);
+  }
 };
 
 ////////////////////////////////////////////////////////////////////////////////
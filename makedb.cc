@@ -3,20 +3,31 @@
 #include <fstream>
 #include <iostream>
 #include <regex>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 #include <libgen.h>
 #include <unistd.h>
 #include "lmdb++.h"
+#include "keyschema.hh"
+#include "metadata.hh"
+#include "valcodec.hh"
 
 int main(int argc, char *argv[]) {
   using namespace std;
 
   uint64_t mapsize = 1024UL * 1024UL;  // lmdb map size in MiB
-  uint64_t chunksize = 0;  // commit chunk size; 0: disable
+  uint64_t chunksize = 0;  // commit chunk size; 0: by batch size
   int verbose = 0;  // verbose output
   string pattern = R"(^(\S+)\s(\S*).*)";  //R"(^(\S+)\s(\S*)(\s+(.*?)\s*)?$)"
   bool overwrite = false;  // overwrite new value for a duplicate key
   bool deleteval = false;  // delete value
+  lmdbtools::key_schema schema;  // composite key components
+  lmdbtools::comparator keyorder;  // key comparator of a new database
+  bool setkeyorder = false;  // whether -c chose the key comparator
+  size_t trainsize = 0;  // values to train a compression dictionary from
+  size_t blobsize = 0;  // size of the values stored out of line; 0: none
 
   string progname = basename(argv[0]);
   string usage = "usage: " + progname +
@@ -26,11 +37,33 @@ int main(int argc, char *argv[]) {
     "         -o           overwrite new value for a duplicate key\n"
     "         -D           delete value\n"
     "         -m <size>    lmdb map size in MiB (" + to_string(mapsize) + ")\n"
-    "         -n <size>    commit chunk size (default 0:disable)\n"
-    "         -v           verbose output\n"
+    "         -n <count>   commit every <count> buffered puts or deletes,\n"
+    "                      counted before duplicates are rejected\n"
+    "                      (default 0: commit once at the end); a full\n"
+    "                      map grows only while a batch holds less than "
+    + to_string(lmdb::batch_writer::default_batch_bytes >> 20) + " MiB\n"
+    "         -t <schema>  store keys of comma separated components with\n"
+    "                      an order-preserving encoding; <schema> lists\n"
+    "                      them: i8-i64, u8-u64, s<N> (N-byte string) or\n"
+    "                      s (string), e.g. \"s,u64,u32\"\n"
+    "         -c <name>    key comparator of a new database, recorded in\n"
+    "                      <targetdb>-meta: bytewise, reverse (bytewise\n"
+    "                      from the last byte) or numeric (by leading\n"
+    "                      decimal number)\n"
+    "         -Z <count>   compress the values of a new database with a\n"
+    "                      dictionary trained from its first <count>\n"
+    "                      values, recorded in <targetdb>-meta\n"
+    "         -B <size>    store the values of a new database that take\n"
+    "                      more than <size> bytes, once compressed, in the\n"
+    "                      append-only file <targetdb>-blob and only a\n"
+    "                      reference in the database; values of more than\n"
+    "                      about half a page take overflow pages\n"
+    "         -v           verbose output; -vv lists the keys already present"
+    + string(lmdb::instrument::enabled
+             ? "\n                      and adds lmdb call statistics\n" : "\n")
     ;
   for (opterr = 0;;) {
-    int opt = getopt(argc, argv, ":p:oDm:n:v");
+    int opt = getopt(argc, argv, ":p:oDm:n:t:c:Z:B:v");
     if (opt == -1) break;
     try {
       switch (opt) {
@@ -39,6 +72,12 @@ int main(int argc, char *argv[]) {
         case 'D': { deleteval = true; break; }
         case 'm': { mapsize = stoul(optarg); break; }
         case 'n': { chunksize = stoul(optarg); break; }
+        case 't': { schema = lmdbtools::key_schema(optarg); break; }
+        case 'c': { keyorder = lmdbtools::comparator::named(optarg);
+                    setkeyorder = true;
+                    break; }
+        case 'Z': { trainsize = stoul(optarg); break; }
+        case 'B': { blobsize = stoul(optarg); break; }
         case 'v': { ++verbose; break; }
         case ':': { cout << "missing argument of -"
                     << static_cast<char>(optopt) << endl;
@@ -60,6 +99,9 @@ int main(int argc, char *argv[]) {
     cout << "too few arguments\n" << usage << flush;
     exit(EXIT_FAILURE);
   }
+  if (verbose > 1) {
+    lmdb::instrument::print_at_exit();
+  }
 
   int oi = optind;
   string odbfname (argv[oi++]);
@@ -76,12 +118,57 @@ int main(int argc, char *argv[]) {
       cerr << odbfname << endl;
     }
 
-    uint64_t cnt = 0;
     smatch match;
     regex pat(pattern);
+    string keybuf;  // encoded key of the schema
+
+    // the keys are sorted and committed at the end, or every -n operations
+    lmdb::batch_writer writer(env);
+    writer.set_batch_entries(chunksize);
+    (setkeyorder ? keyorder : lmdbtools::comparator::of(odbfname))
+      .adopt(odbfname, writer);
+    if (verbose > 1) {
+      writer.on_exist([&schema](const MDB_val &key) {
+        const char *data = static_cast<const char *>(key.mv_data);
+        string keystr;
+        if (schema.empty()) {
+          keystr.assign(data, key.mv_size);
+        } else {
+          schema.decode(data, key.mv_size, keystr);
+        }
+        cerr << "== " << keystr << endl;
+      });
+    }
 
-    auto wtxn = lmdb::txn::begin(env);
-    auto dbi  = lmdb::dbi::open(wtxn);
+    // the values are encoded as recorded for the database, or with a
+    // dictionary trained from the first values, which are held back until
+    // it is ready
+    auto codec = lmdbtools::value_codec::of(odbfname);
+    if (!codec.active() && blobsize > 0 && trainsize == 0) {
+      codec = lmdbtools::value_codec(string(), blobsize)
+        .adopt(odbfname, writer);
+    }
+    // appended values reach storage before the entries that refer to them
+    writer.on_commit([&codec]() { codec.sync(); });
+    string valbuf;  // encoded value
+    vector<pair<string, string>> pending;
+    bool training = trainsize > 0 && !codec.active();
+    auto train = [&]() {
+      vector<string> samples;
+      samples.reserve(pending.size());
+      for (const auto &e : pending) {
+        samples.push_back(e.second);
+      }
+      codec = lmdbtools::value_codec(lmdbtools::value_codec::train(samples),
+                                     blobsize).adopt(odbfname, writer);
+      for (const auto &e : pending) {
+        const lmdb::val key(e.first);
+        const lmdb::val val(e.second);
+        writer.put(key, codec.encode(val, valbuf), put_flags);
+      }
+      pending.clear();
+      training = false;
+    };
 
     for (int i = oi; i < argc; ++i) {
       string itxtfname(argv[i]);
@@ -89,39 +176,47 @@ int main(int argc, char *argv[]) {
         cerr << "+ " << itxtfname << endl;
       }
       ifstream ifs(itxtfname);
+      size_t lineno = 0;
       for (string line; getline(ifs, line);) {
+        ++lineno;
         if (regex_match(line, match, pat)) {
           if (match.size() <= 1)
             continue;
           const string &keystr = (match.size() >= 2 ? match.str(1) : "");
           const string &valstr = (match.size() >= 3 && !deleteval
               ? match.str(2) : "");
-          const lmdb::val key(keystr);
-          /* no const */ lmdb::val val(valstr);
-          if (!dbi.put(wtxn, key, val, put_flags)) {
-            if (verbose > 1) {
-              cerr << "== " << keystr << endl;
+          if (!schema.empty()) {
+            try {
+              schema.encode(keystr.data(), keystr.size(), keybuf);
             }
-          }
-          else {
-            if (chunksize > 0 && ++cnt >= chunksize) {
-              // commit and reopen transaction
-              if (verbose > 2) {
-                cerr << "commit " << cnt << endl;
-              }
-              wtxn.commit();
-              wtxn = lmdb::txn::begin(env);
-              dbi  = lmdb::dbi::open(wtxn);
-              cnt = 0;
+            catch (const runtime_error &e) {
+              throw runtime_error(itxtfname + ":" + to_string(lineno) + ": "
+                                  + e.what());
             }
           }
+          if (training) {
+            pending.emplace_back(schema.empty() ? keystr : keybuf, valstr);
+            if (pending.size() >= trainsize) train();
+            continue;
+          }
+          const lmdb::val key(schema.empty() ? keystr : keybuf);
+          const lmdb::val val(valstr);
+          writer.put(key, codec.encode(val, valbuf), put_flags);
         }
       }
     }
+    if (training) train();
 
-    MDB_stat st = dbi.stat(wtxn);
+    if (verbose > 0 && !codec.dictionary().empty()) {
+      cerr << "dictionary: " << codec.dictionary().size() << " bytes" << endl;
+    }
+    if (verbose > 0 && codec.blob_threshold() > 0) {
+      cerr << "blob threshold: " << codec.blob_threshold() << " bytes"
+           << endl;
+    }
+    MDB_stat st = writer.stat();
     cout << odbfname << '\t' << st.ms_entries << endl;
-    wtxn.commit();
+    writer.commit();
   }
   catch (const lmdb::error &e) {
     cerr << e.what() << endl;
@@ -131,5 +226,9 @@ int main(int argc, char *argv[]) {
     cerr << e.what() << ": pattern: " << pattern << endl;
     return EXIT_FAILURE;
   }
+  catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
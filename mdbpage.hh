@@ -0,0 +1,399 @@
+#ifndef LMDBTOOLS_MDBPAGE_HH
+#define LMDBTOOLS_MDBPAGE_HH
+
+/**
+ * Read-only view of the on-disk B-tree pages of an LMDB 0.9 environment.
+ *
+ * The view walks the pages of the memory map directly. It is used to
+ * schedule prefetches and to sample the tree cheaply. Every page it
+ * touches is range- and sanity-checked, so a layout it does not recognise
+ * makes `valid()` false instead of reading outside the map.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <lmdb.h>
+
+namespace lmdbtools {
+namespace mdbpage {
+
+/* Layout constants mirrored from mdb.c (64-bit, little-endian build). */
+constexpr std::size_t page_header_size = 16;  // PAGEHDRSZ
+constexpr std::size_t node_header_size = 8;   // NODESIZE
+constexpr std::uint16_t p_branch   = 0x01;
+constexpr std::uint16_t p_leaf     = 0x02;
+constexpr std::uint16_t p_overflow = 0x04;
+constexpr std::uint16_t p_leaf2    = 0x20;
+constexpr std::uint16_t f_bigdata  = 0x01;
+constexpr std::uint16_t f_subdata  = 0x02;
+constexpr std::uint16_t f_dupdata  = 0x04;
+constexpr std::uint32_t meta_magic = 0xBEEFC0DE;
+constexpr std::size_t invalid_pgno = ~static_cast<std::size_t>(0);
+constexpr unsigned max_depth = 32;
+
+template<typename T>
+inline T load(const char* const p) noexcept {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+inline std::uint16_t page_flags(const char* const page) noexcept {
+  return load<std::uint16_t>(page + 10);
+}
+
+inline std::uint16_t page_lower(const char* const page) noexcept {
+  return load<std::uint16_t>(page + 12);
+}
+
+inline std::uint16_t page_upper(const char* const page) noexcept {
+  return load<std::uint16_t>(page + 14);
+}
+
+inline bool is_branch(const char* const page) noexcept {
+  return page_flags(page) & p_branch;
+}
+
+inline bool is_leaf(const char* const page) noexcept {
+  return page_flags(page) & p_leaf;
+}
+
+/** Returns the number of nodes on a branch or leaf page. */
+inline unsigned nkeys(const char* const page) noexcept {
+  return (page_lower(page) - page_header_size) >> 1;
+}
+
+/** Returns the number of pages of an overflow page run. */
+inline std::uint32_t overflow_pages(const char* const page) noexcept {
+  return load<std::uint32_t>(page + 12);
+}
+
+inline const char* node(const char* const page,
+                        const unsigned i) noexcept {
+  return page + load<std::uint16_t>(page + page_header_size + 2 * i);
+}
+
+inline std::uint16_t node_flags(const char* const node) noexcept {
+  return load<std::uint16_t>(node + 4);
+}
+
+inline MDB_val node_key(const char* const node) noexcept {
+  return MDB_val{load<std::uint16_t>(node + 6),
+                 const_cast<char*>(node + node_header_size)};
+}
+
+/** Returns the data size of a leaf node. */
+inline std::size_t node_dsize(const char* const node) noexcept {
+  return load<std::uint16_t>(node) |
+    (static_cast<std::size_t>(load<std::uint16_t>(node + 2)) << 16);
+}
+
+/** Returns the child page number of a branch node. */
+inline std::size_t node_pgno(const char* const node) noexcept {
+  return node_dsize(node) |
+    (static_cast<std::size_t>(load<std::uint16_t>(node + 4)) << 32);
+}
+
+/**
+ * Returns the largest size of a node stored on a page (`me_nodemax`).
+ */
+inline std::size_t node_max(const std::size_t psize) noexcept {
+  return (((psize - page_header_size) / 2) & ~static_cast<std::size_t>(1))
+    - sizeof(std::uint16_t);
+}
+
+/**
+ * Returns whether a value is stored on overflow pages (`F_BIGDATA`).
+ */
+inline bool is_big(const std::size_t psize,
+                   const std::size_t ksize,
+                   const std::size_t dsize) noexcept {
+  return node_header_size + ksize + dsize > node_max(psize);
+}
+
+/**
+ * Returns the number of overflow pages of a big value (`OVPAGES`).
+ */
+inline std::size_t value_pages(const std::size_t psize,
+                               const std::size_t dsize) noexcept {
+  return (page_header_size - 1 + dsize) / psize + 1;
+}
+
+/**
+ * B-tree of the main database of a read-only transaction.
+ */
+class tree {
+  MDB_txn* _txn{nullptr};
+  MDB_dbi _dbi{0};
+  const char* _map{nullptr};
+  std::size_t _psize{0};
+  std::size_t _last_pgno{0};
+  std::size_t _root{invalid_pgno};
+  unsigned _depth{0};
+  std::size_t _entries{0};
+
+public:
+  tree() noexcept = default;
+
+  /**
+   * Locates the memory map and the root page of `dbi`, which must be the
+   * main (unnamed) database. The map base is derived from a key pointer
+   * returned by LMDB and the page number stored in that page's header,
+   * then confirmed against the meta page magic.
+   */
+  tree(MDB_txn* const txn,
+       const MDB_dbi dbi) noexcept
+    : _txn{txn}, _dbi{dbi} {
+    MDB_stat st;
+    MDB_envinfo info;
+    MDB_cursor* cursor{nullptr};
+    MDB_val key{0, nullptr};
+    if (dbi != 1  // MAIN_DBI
+        || ::mdb_stat(txn, dbi, &st) != MDB_SUCCESS
+        || ::mdb_env_info(::mdb_txn_env(txn), &info) != MDB_SUCCESS
+        || ::mdb_cursor_open(txn, dbi, &cursor) != MDB_SUCCESS) {
+      return;
+    }
+    const int rc = ::mdb_cursor_get(cursor, &key, nullptr, MDB_FIRST);
+    ::mdb_cursor_close(cursor);
+    if (rc != MDB_SUCCESS || st.ms_psize < 512) return;
+
+    const std::size_t psize = st.ms_psize;
+    const auto addr = reinterpret_cast<std::uintptr_t>(key.mv_data);
+    const char* const leaf = reinterpret_cast<const char*>(addr - addr % psize);
+    const std::size_t pgno = load<std::size_t>(leaf);
+    if (pgno > info.me_last_pgno || pgno * psize > addr) return;
+    const char* const map = leaf - pgno * psize;
+
+    // pick the newer of the two meta pages as LMDB does
+    const char* best = nullptr;
+    std::size_t best_txnid = 0;
+    for (std::size_t m = 0; m < 2; ++m) {
+      const char* const meta = map + m * psize + page_header_size;
+      if (load<std::uint32_t>(meta) != meta_magic) return;
+      const std::size_t txnid = load<std::size_t>(meta + 128);
+      if (!best || txnid > best_txnid) {
+        best = meta;
+        best_txnid = txnid;
+      }
+    }
+    const char* const main_db = best + 24 + 48;  // mm_dbs[MAIN_DBI]
+    _map = map;
+    _psize = psize;
+    _last_pgno = info.me_last_pgno;
+    _depth = load<std::uint16_t>(main_db + 6);
+    _entries = load<std::size_t>(main_db + 32);
+    _root = load<std::size_t>(main_db + 40);
+    if (_root > _last_pgno || _depth > max_depth) {
+      _map = nullptr;
+    }
+  }
+
+  bool valid() const noexcept { return _map != nullptr; }
+  const char* map() const noexcept { return _map; }
+  std::size_t psize() const noexcept { return _psize; }
+  std::size_t root() const noexcept { return _root; }
+  std::size_t last_pgno() const noexcept { return _last_pgno; }
+  unsigned depth() const noexcept { return _depth; }
+  std::size_t entries() const noexcept { return _entries; }
+
+  /**
+   * Returns the branch or leaf page `pgno`, or `nullptr` if it is out of
+   * range or does not look like a well-formed page.
+   */
+  const char* page(const std::size_t pgno) const noexcept {
+    if (!_map || pgno > _last_pgno) return nullptr;
+    const char* const p = _map + pgno * _psize;
+    if (load<std::size_t>(p) != pgno) return nullptr;
+    const std::uint16_t flags = page_flags(p);
+    if (!(flags & (p_branch | p_leaf)) || (flags & p_leaf2)) return nullptr;
+    const std::size_t lower = page_lower(p);
+    const std::size_t upper = page_upper(p);
+    if (lower < page_header_size || lower > upper || upper > _psize) {
+      return nullptr;
+    }
+    return p;
+  }
+
+  /**
+   * Returns the overflow page run starting at `pgno`, or `nullptr`.
+   */
+  const char* overflow(const std::size_t pgno) const noexcept {
+    if (!_map || pgno > _last_pgno) return nullptr;
+    const char* const p = _map + pgno * _psize;
+    if (load<std::size_t>(p) != pgno || !(page_flags(p) & p_overflow)) {
+      return nullptr;
+    }
+    return p;
+  }
+
+  /**
+   * Returns node `i` of page `page`, or `nullptr` if the node would not
+   * lie within the page.
+   */
+  const char* checked_node(const char* const page,
+                           const unsigned i) const noexcept {
+    const std::size_t offset = node(page, i) - page;
+    if (offset < page_upper(page) || offset + node_header_size > _psize) {
+      return nullptr;
+    }
+    const char* const n = page + offset;
+    if (offset + node_header_size + node_key(n).mv_size > _psize) {
+      return nullptr;
+    }
+    return n;
+  }
+
+  /**
+   * Returns the child of branch page `page` whose subtree may hold `key`,
+   * comparing with the database's comparator as `mdb_get()` does, or
+   * `invalid_pgno` if the page is malformed.
+   */
+  std::size_t child(const char* const page,
+                    const MDB_val& key) const noexcept {
+    unsigned lo = 1;
+    unsigned hi = nkeys(page);
+    while (lo < hi) {  // first node whose key is greater than `key`
+      const unsigned mid = lo + (hi - lo) / 2;
+      const char* const n = checked_node(page, mid);
+      if (!n) return invalid_pgno;
+      const MDB_val k = node_key(n);
+      if (::mdb_cmp(_txn, _dbi, &key, &k) < 0) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    const char* const n = checked_node(page, lo - 1);
+    return n ? node_pgno(n) : invalid_pgno;
+  }
+
+  /**
+   * Calls `f(page, level)` for each branch and leaf page of the tree,
+   * depth first.
+   *
+   * @retval false if the walk stopped at a malformed page
+   */
+  template<typename F>
+  bool walk(F f) const {
+    if (!valid()) return false;
+    std::vector<std::pair<std::size_t, unsigned>> stack{{_root, 0}};
+    while (!stack.empty()) {
+      const std::size_t pgno = stack.back().first;
+      const unsigned level = stack.back().second;
+      stack.pop_back();
+      const char* const p = page(pgno);
+      if (!p || level >= max_depth) return false;
+      f(p, level);
+      if (!is_branch(p)) continue;
+      for (unsigned i = nkeys(p); i-- > 0;) {
+        const char* const n = checked_node(p, i);
+        if (!n) return false;
+        stack.emplace_back(node_pgno(n), level + 1);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Draws one entry at random by a descent from the root that picks each
+   * child or leaf node uniformly and is rejected with probability
+   * `1 - nkeys / bounds[level]` below the root (Olken's acceptance/rejection
+   * sampling). Every entry is then equally likely however full the pages
+   * on its path are, as long as `bounds` holds the largest node count of
+   * each level. The bounds are learnt from the pages seen and grow when a
+   * fuller page turns up, so the first draws, which mainly warm them up,
+   * are slightly biased.
+   *
+   * @param bounds  node count bound per level, all zero at first
+   * @param key     receives the key of the drawn entry
+   * @retval false if the descent was rejected or met a malformed page or
+   *         a duplicate-sorted node; the caller just draws again
+   */
+  template<typename URNG>
+  bool sample(URNG& rng,
+              std::vector<unsigned>& bounds,
+              MDB_val& key) const {
+    if (!valid()) return false;
+    if (bounds.size() < _depth) bounds.resize(_depth, 0);
+    const char* p = page(_root);
+    for (unsigned level = 0; p && level < bounds.size(); ++level) {
+      const unsigned n = nkeys(p);
+      if (n == 0) return false;
+      bounds[level] = std::max(bounds[level], n);
+      const unsigned range = (level == 0) ? n : bounds[level];
+      std::uniform_int_distribution<unsigned> pick(0, range - 1);
+      const unsigned i = pick(rng);
+      if (i >= n) return false;
+      const char* const nd = checked_node(p, i);
+      if (!nd) return false;
+      if (is_leaf(p)) {
+        if (node_flags(nd) & f_dupdata) return false;
+        key = node_key(nd);
+        return true;
+      }
+      p = page(node_pgno(nd));
+    }
+    return false;
+  }
+
+  /**
+   * Returns up to `count` keys, in key order, that split the database into
+   * ranges of about equal page count. They are picked evenly from the keys
+   * of the topmost branch levels, which are expanded until a level holds
+   * at least `count` pages or the leaves are reached. An empty result means
+   * the tree is too small or could not be walked.
+   */
+  std::vector<std::string> separators(const std::size_t count) const {
+    std::vector<std::string> keys;
+    if (!valid() || count == 0) return keys;
+    std::vector<std::size_t> level{_root};
+    for (unsigned d = 0; d < max_depth && level.size() <= count; ++d) {
+      std::vector<std::size_t> next;
+      for (const std::size_t pgno : level) {
+        const char* const p = page(pgno);
+        if (!p) return std::vector<std::string>();
+        if (!is_branch(p)) {
+          next.clear();
+          break;
+        }
+        for (unsigned i = 0; i < nkeys(p); ++i) {
+          const char* const n = checked_node(p, i);
+          if (!n) return std::vector<std::string>();
+          const MDB_val k = node_key(n);
+          if (i > 0 && k.mv_size > 0) {  // node 0 carries no key
+            keys.emplace_back(static_cast<const char*>(k.mv_data), k.mv_size);
+          }
+          next.push_back(node_pgno(n));
+        }
+      }
+      if (next.empty()) break;
+      level.swap(next);
+    }
+    std::sort(keys.begin(), keys.end(),
+              [this](const std::string& a, const std::string& b) {
+      const MDB_val x{a.size(), const_cast<char*>(a.data())};
+      const MDB_val y{b.size(), const_cast<char*>(b.data())};
+      return ::mdb_cmp(_txn, _dbi, &x, &y) < 0;
+    });
+    if (keys.size() > count) {
+      std::vector<std::string> picked;
+      for (std::size_t i = 1; i <= count; ++i) {
+        picked.push_back(std::move(keys[i * keys.size() / (count + 1)]));
+      }
+      keys.swap(picked);
+    }
+    return keys;
+  }
+};
+
+}  // namespace mdbpage
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_MDBPAGE_HH
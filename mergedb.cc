@@ -1,10 +1,13 @@
 #include <cerrno>
 #include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <libgen.h>
 #include <unistd.h>
 #include "lmdb++.h"
+#include "metadata.hh"
+#include "valcodec.hh"
 
 int main(int argc, char *argv[]) {
   using namespace std;
@@ -20,7 +23,9 @@ int main(int argc, char *argv[]) {
     " [options] <targetdb> <dbname1> <dbname2>\n"
     "options: -s <string>  separator of values (" + separator + ")\n"
     "         -m <size>    lmdb map size in MiB (" + to_string(mapsize) + ")\n"
-    "         -v           verbose output\n"
+    "         -v           verbose output"
+    + string(lmdb::instrument::enabled
+             ? "; -vv adds lmdb call statistics\n" : "\n")
     ;
   for (opterr = 0;;) {
     int opt = getopt(argc, argv, ":s:m:v");
@@ -50,6 +55,9 @@ int main(int argc, char *argv[]) {
     cout << "too few arguments\n" << usage << flush;
     exit(EXIT_FAILURE);
   }
+  if (verbose > 1) {
+    lmdb::instrument::print_at_exit();
+  }
 
   int oi = optind;
   const string odbfname(argv[oi++]);
@@ -59,12 +67,44 @@ int main(int argc, char *argv[]) {
   const unsigned int put_flags = (overwrite ? 0 : MDB_NOOVERWRITE);
 
   try {
+    // the merge walks both inputs in one key order, which the recorded
+    // comparators tell without opening the databases
+    const auto cmp1 = lmdbtools::comparator::of(idbfname1);
+    const auto cmp2 = lmdbtools::comparator::of(idbfname2);
+    if (cmp1 != cmp2) {
+      cerr << "error: comparator mismatch: " << idbfname1 << " ("
+        << cmp1.name() << "), " << idbfname2 << " (" << cmp2.name() << ")"
+        << endl;
+      return EXIT_FAILURE;
+    }
+
     auto env0 = lmdb::env::create();
     env0.set_mapsize(mapsize * 1024UL * 1024UL);
     env0.open(odbfname.c_str(), MDB_NOSUBDIR | MDB_NOLOCK);
 
-    auto wtxn0 = lmdb::txn::begin(env0, nullptr);
-    auto dbi0  = lmdb::dbi::open(wtxn0);
+    // the merged keys arrive in order and are appended in one transaction
+    lmdb::batch_writer writer0(env0);
+    cmp1.adopt(odbfname, writer0);
+
+    // a new database takes the dictionary of the inputs; the values pass
+    // through as they are between databases with the same dictionary and
+    // are otherwise decoded and encoded again
+    auto codec1 = lmdbtools::value_codec::of(idbfname1);
+    auto codec2 = lmdbtools::value_codec::of(idbfname2);
+    auto codec0 = (codec1.active() ? codec1 : codec2).adopt(odbfname, writer0);
+    // appended values reach storage before the entries that refer to them
+    writer0.on_commit([&codec0]() { codec0.sync(); });
+    const bool same1 = codec1 == codec0;
+    const bool same2 = codec2 == codec0;
+    string buf0, buf1, buf2;
+    auto put = [&](const lmdb::val &key, const lmdb::val &val,
+                   lmdbtools::value_codec &codec, bool same) {
+      if (same) {
+        writer0.put(key, val);
+      } else {
+        writer0.put(key, codec0.encode(codec.decode(val, buf1), buf0));
+      }
+    };
 
 
     auto env1 = lmdb::env::create();
@@ -73,6 +113,7 @@ int main(int argc, char *argv[]) {
 
     auto rtxn1 = lmdb::txn::begin(env1, nullptr, MDB_RDONLY);
     auto dbi1  = lmdb::dbi::open(rtxn1);
+    cmp1.apply(rtxn1, dbi1);
 
 
     auto env2 = lmdb::env::create();
@@ -81,24 +122,16 @@ int main(int argc, char *argv[]) {
 
     auto rtxn2 = lmdb::txn::begin(env2, nullptr, MDB_RDONLY);
     auto dbi2  = lmdb::dbi::open(rtxn2);
+    cmp2.apply(rtxn2, dbi2);
 
 
-    MDB_stat st0 = dbi0.stat(wtxn0);
+    MDB_stat st0 = writer0.stat();
     MDB_stat st1 = dbi1.stat(rtxn1);
     MDB_stat st2 = dbi2.stat(rtxn2);
     cout << odbfname << "(" << st0.ms_entries << ") <-- "
       << idbfname1 << "(" << st1.ms_entries << ") U "
       << idbfname2 << "(" << st2.ms_entries << ")" << endl;
 
-#if 0
-    const MDB_cmp_func *cmpf1 = rtxn1.handle()->mt_dbxs[dbi1.handle()].md_cmp;
-    const MDB_cmp_func *cmpf2 = rtxn2.handle()->mt_dbxs[dbi2.handle()].md_cmp;
-    if (cmpf1 != cmpf2) {
-      cerr << "error: comparator miss match" << endl;
-      exit(EXIT_FAILURE);
-    }
-#endif
-
     auto cursor1 = lmdb::cursor::open(rtxn1, dbi1);
     lmdb::val key1;
     lmdb::val val1;
@@ -124,30 +157,32 @@ int main(int argc, char *argv[]) {
       const string key2str(key2.data(), key2.size());
       if (read1) cout << "1 " << key1str << endl;
       if (read2) cout << "2 " << key2str << endl;
-      cout << "cmp(" <<{aka ‘struct MDB_txn’} key1str << ", " << key2str << ") = " << cmp << endl;
+      cout << "cmp(" << key1str << ", " << key2str << ") = " << cmp << endl;
 #endif
 
       if (read1 && read2) {  // if both items are ready
         cmp = mdb_cmp(rtxn1, dbi1, key1, key2);
 
         if (cmp < 0) {
-          dbi0.put(wtxn0, key1, val1);
+          put(key1, val1, codec1, same1);
           //cout << "write 1 " << key1str << endl;
         }
         else if (cmp > 0) {
-          dbi0.put(wtxn0, key2, val2);
+          put(key2, val2, codec2, same2);
           //cout << "write 2 " << key2str << endl;
         }
         else /* if (cmp == 0) */ {
-          const string val1str(val1.data(), val1.size());
-          const string val2str(val2.data(), val2.size());
+          const lmdb::val v1 = codec1.decode(val1, buf1);
+          const lmdb::val v2 = codec2.decode(val2, buf2);
+          const string val1str(v1.data(), v1.size());
+          const string val2str(v2.data(), v2.size());
           string newvalstr;
           newvalstr += val1str;
           newvalstr += (!val1str.empty() && !val2str.empty()) ? separator : "";
           newvalstr += val2str;
           lmdb::val newval(newvalstr);
 
-          dbi0.put(wtxn0, key1, newval);
+          writer0.put(key1, codec0.encode(newval, buf0));
           //cout << "write 12 " << key1str << endl;
           if (verbose > 2) {
             const string keystr(key1.data(), key1.size());
@@ -159,20 +194,20 @@ int main(int argc, char *argv[]) {
       else if (read1 && !read2) {
         // if no more item exists in db2, then
         // put all remained items in db1 to db0 and exit
-        dbi0.put(wtxn0, key1, val1);
+        put(key1, val1, codec1, same1);
         //cout << "write 1 " << key1str << endl;
         while (cursor1.get(key1, val1, MDB_NEXT)) {
-          dbi0.put(wtxn0, key1, val1);
+          put(key1, val1, codec1, same1);
           //cout << "write 1 " << key1str << endl;
         }
       }
       else if (!read1 && read2) {
         // if no more item exists in db1, then
         // put all remained items in db2 to db0 and exit
-        dbi0.put(wtxn0, key2, val2);
+        put(key2, val2, codec2, same2);
         //cout << "write 2 " << key2str << endl;
         while (cursor2.get(key2, val2, MDB_NEXT)) {
-          dbi0.put(wtxn0, key2, val2);
+          put(key2, val2, codec2, same2);
           //cout << "write 2 " << key2str << endl;
         }
       }
@@ -185,13 +220,17 @@ int main(int argc, char *argv[]) {
     rtxn2.abort();
     rtxn1.abort();
 
-    MDB_stat st = dbi0.stat(wtxn0);
+    MDB_stat st = writer0.stat();
     cout << odbfname << '\t' << st.ms_entries << endl;
-    wtxn0.commit();
+    writer0.commit();
   }
   catch (const lmdb::error &e) {
     cerr << e.what() << endl;
     return EXIT_FAILURE;
   }
+  catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
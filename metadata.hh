@@ -0,0 +1,208 @@
+#ifndef LMDBTOOLS_METADATA_HH
+#define LMDBTOOLS_METADATA_HH
+
+/**
+ * Metadata of a database and the key comparator recorded in it.
+ *
+ * The tools keep their entries in the main database of an environment,
+ * where LMDB also keeps the records of named databases, so a named
+ * metadata database would show up among the keys of every dump and merge.
+ * The metadata of database `<db>` is therefore kept in the main database
+ * of a companion environment `<db>-meta`, next to the `<db>-filter`
+ * sidecar. A database without one has no metadata.
+ */
+
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include "lmdb++.h"
+
+namespace lmdbtools {
+
+class metadata {
+  std::map<std::string, std::string> _entries;
+
+public:
+  static constexpr std::size_t mapsize = 64UL << 20;
+
+  /**
+   * Reads the metadata of database `dbname`; it is empty if there is none.
+   *
+   * @throws lmdb::error on failure
+   */
+  static metadata load(const std::string& dbname) {
+    metadata meta;
+    const std::string path = path_of(dbname);
+    if (::access(path.c_str(), F_OK) != 0) return meta;
+    auto env = lmdb::env::create();
+    env.set_mapsize(mapsize);
+    env.open(path.c_str(), MDB_NOSUBDIR | MDB_NOLOCK | MDB_RDONLY);
+    auto rtxn = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
+    auto dbi = lmdb::dbi::open(rtxn);
+    auto cursor = lmdb::cursor::open(rtxn, dbi);
+    for (const auto& e : cursor.range()) {
+      meta._entries.emplace(std::string(e.key.data(), e.key.size()),
+                            std::string(e.value.data(), e.value.size()));
+    }
+    cursor.close();
+    rtxn.abort();
+    return meta;
+  }
+
+  /**
+   * Writes the entries to the metadata of database `dbname`.
+   *
+   * @throws lmdb::error on failure
+   */
+  void save(const std::string& dbname) const {
+    const std::string path = path_of(dbname);
+    auto env = lmdb::env::create();
+    env.set_mapsize(mapsize);
+    env.open(path.c_str(), MDB_NOSUBDIR | MDB_NOLOCK);
+    auto wtxn = lmdb::txn::begin(env);
+    auto dbi = lmdb::dbi::open(wtxn);
+    for (const auto& e : _entries) {
+      const lmdb::val key(e.first);
+      lmdb::val value(e.second);
+      dbi.put(wtxn, key, value);
+    }
+    wtxn.commit();
+  }
+
+  bool empty() const noexcept { return _entries.empty(); }
+
+  /**
+   * Returns the value of an entry, or `nullptr` if there is none.
+   */
+  const std::string* find(const std::string& name) const {
+    const auto it = _entries.find(name);
+    return it == _entries.end() ? nullptr : &it->second;
+  }
+
+  void set(const std::string& name, const std::string& value) {
+    _entries[name] = value;
+  }
+
+  /**
+   * Returns the metadata path of database `dbname`.
+   */
+  static std::string path_of(const std::string& dbname) {
+    return dbname + "-meta";
+  }
+};
+
+/**
+ * Built-in key order of a database, set with `mdb_set_compare()` on every
+ * open: `bytewise`, LMDB's own order, `reverse`, bytewise from the last
+ * byte, and `numeric`, by leading decimal number. A database without a
+ * recorded comparator is in bytewise order and keeps LMDB's own function;
+ * a recorded `bytewise` one tells apart keys differing early faster.
+ */
+class comparator {
+  const char* _name{"bytewise"};
+  MDB_cmp_func* _func{nullptr};  // nullptr: LMDB's own
+  bool _bytewise{true};
+
+  comparator(const char* name, MDB_cmp_func* func, bool bytewise) noexcept
+    : _name{name}, _func{func}, _bytewise{bytewise} {}
+
+public:
+  comparator() noexcept = default;
+
+  /**
+   * @throws std::runtime_error on an unknown comparator
+   */
+  static comparator named(const std::string& name) {
+    if (name == "bytewise") return {"bytewise", lmdb::compare_bytes, true};
+    if (name == "reverse") return {"reverse", lmdb::compare_reverse, false};
+    if (name == "numeric") return {"numeric", lmdb::compare_numeric, false};
+    throw std::runtime_error("unknown comparator: \"" + name + "\"");
+  }
+
+  /**
+   * Returns the comparator recorded in metadata.
+   *
+   * @throws std::runtime_error on an unknown comparator
+   */
+  static comparator of(const metadata& meta) {
+    const std::string* const name = meta.find("comparator");
+    return name ? named(*name) : comparator();
+  }
+
+  /**
+   * Returns the comparator recorded for database `dbname`.
+   *
+   * @throws lmdb::error on failure to read the metadata
+   * @throws std::runtime_error on an unknown comparator
+   */
+  static comparator of(const std::string& dbname) {
+    return of(metadata::load(dbname));
+  }
+
+  const char* name() const noexcept { return _name; }
+  MDB_cmp_func* func() const noexcept { return _func; }
+
+  /**
+   * Whether the keys sharing a prefix are adjacent in this order, so that
+   * a prefix can be sought.
+   */
+  bool bytewise() const noexcept { return _bytewise; }
+
+  /**
+   * Whether two comparators order keys alike.
+   */
+  bool operator==(const comparator& other) const noexcept {
+    return std::string(_name) == other._name;
+  }
+
+  bool operator!=(const comparator& other) const noexcept {
+    return !(*this == other);
+  }
+
+  /**
+   * Sets this comparator on a database opened in a transaction.
+   *
+   * @throws lmdb::error on failure
+   */
+  void apply(MDB_txn* const txn, const MDB_dbi dbi) const {
+    if (_func) lmdb::dbi_set_compare(txn, dbi, _func);
+  }
+
+  void apply(lmdb::batch_writer& writer) const {
+    if (_func) writer.set_compare(_func);
+  }
+
+  /**
+   * Makes this the comparator of database `dbname` written by `writer`:
+   * it must agree with the comparator recorded for the database, and is
+   * recorded if there is none and the order is not LMDB's own.
+   *
+   * @throws std::runtime_error on a comparator the database cannot take
+   * @throws lmdb::error on failure
+   */
+  void adopt(const std::string& dbname, lmdb::batch_writer& writer) const {
+    metadata meta = metadata::load(dbname);
+    if (meta.find("comparator")) {
+      const comparator recorded = of(meta);
+      if (recorded != *this) {
+        throw std::runtime_error(dbname + ": comparator mismatch: "
+                                 + recorded.name() + " != " + _name);
+      }
+    } else if (_func) {
+      // the entries of a database without a comparator are bytewise
+      if (!_bytewise && writer.stat().ms_entries > 0) {
+        throw std::runtime_error(dbname + ": comparator " + _name
+                                 + " cannot reorder existing entries");
+      }
+      meta.set("comparator", _name);
+      meta.save(dbname);
+    }
+    apply(writer);
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_METADATA_HH
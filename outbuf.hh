@@ -0,0 +1,184 @@
+#ifndef LMDBTOOLS_OUTBUF_HH
+#define LMDBTOOLS_OUTBUF_HH
+
+/**
+ * Buffered writer of record output to a file descriptor.
+ *
+ * Keys and values are appended straight from the memory map into one large
+ * page-aligned buffer, which goes out with a single write(2) when full.
+ * Pieces of at least half the buffer size skip the copy and go out together
+ * with the buffered bytes through writev(2), or on Linux optionally through
+ * vmsplice(2) into a pipe.
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace lmdbtools {
+
+class output_writer {
+  int _fd;
+  char* _buf{nullptr};
+  std::size_t _capacity;
+  std::size_t _size{0};
+  bool _splice{false};
+
+protected:
+  static void raise(const char* const origin) {
+    throw std::system_error(errno, std::system_category(), origin);
+  }
+
+  void write_all(struct iovec* iov,
+                 int iovcnt) {
+    while (iovcnt > 0) {
+      const ssize_t n = ::writev(_fd, iov, iovcnt);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        raise("write");
+      }
+      std::size_t done = static_cast<std::size_t>(n);
+      while (iovcnt > 0 && done >= iov->iov_len) {
+        done -= iov->iov_len;
+        ++iov;
+        --iovcnt;
+      }
+      if (iovcnt > 0) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+        iov->iov_len -= done;
+      }
+    }
+  }
+
+  /**
+   * Passes on the buffered bytes together with a piece that bypasses the
+   * buffer. Writers transforming their output override this; the pieces
+   * are only valid until it returns.
+   */
+  virtual void drain(struct iovec* iov,
+                     int iovcnt) {
+    write_all(iov, iovcnt);
+  }
+
+  /**
+   * Waits until everything drained so far has reached the descriptor.
+   */
+  virtual void settle() {}
+
+  void spill() {
+    if (_size == 0) return;
+    struct iovec iov{_buf, _size};
+    _size = 0;
+    drain(&iov, 1);
+  }
+
+private:
+  void splice_all(const char* data,
+                  std::size_t size) {
+#ifdef __linux__
+    while (size > 0) {
+      struct iovec iov{const_cast<char*>(data), size};
+      const ssize_t n = ::vmsplice(_fd, &iov, 1, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        raise("vmsplice");
+      }
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+#else
+    struct iovec iov{const_cast<char*>(data), size};
+    write_all(&iov, 1);
+#endif
+  }
+
+public:
+  static constexpr std::size_t default_capacity = 1UL << 20;
+
+  explicit output_writer(const int fd,
+                         const std::size_t capacity = default_capacity)
+    : _fd{fd},
+      _capacity{capacity < 4096 ? 4096 : capacity} {
+    void* p = nullptr;
+    if (::posix_memalign(&p, 4096, _capacity) != 0) {
+      throw std::bad_alloc();
+    }
+    _buf = static_cast<char*>(p);
+  }
+
+  output_writer(const output_writer&) = delete;
+  output_writer& operator=(const output_writer&) = delete;
+
+  /**
+   * Flushes the buffer, ignoring errors.
+   */
+  virtual ~output_writer() noexcept {
+    try {
+      flush();
+    }
+    catch (...) {}
+    std::free(_buf);
+  }
+
+  /**
+   * Hands pieces of at least half the buffer size to a pipe with
+   * vmsplice(2) instead of copying them. The pipe then refers to the
+   * caller's memory, which must stay unchanged until the reader has
+   * consumed it, as do the pages of a map no writer reuses meanwhile.
+   *
+   * @retval false if the descriptor is not a pipe or vmsplice(2) is not
+   *         available, in which case the writer keeps copying
+   */
+  virtual bool enable_splice() noexcept {
+#ifdef __linux__
+    struct stat st;
+    _splice = ::fstat(_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+#endif
+    return _splice;
+  }
+
+  void append(const char* const data,
+              const std::size_t size) {
+    if (size <= _capacity - _size) {
+      std::memcpy(_buf + _size, data, size);
+      _size += size;
+    } else if (size < _capacity / 2) {
+      spill();
+      std::memcpy(_buf, data, size);
+      _size = size;
+    } else if (_splice) {
+      spill();
+      splice_all(data, size);
+    } else {
+      struct iovec iov[2] = {{_buf, _size}, {const_cast<char*>(data), size}};
+      _size = 0;
+      drain(iov, 2);
+    }
+  }
+
+  void append(const std::string& s) {
+    append(s.data(), s.size());
+  }
+
+  void put(const char c) {
+    if (_size == _capacity) spill();
+    _buf[_size++] = c;
+  }
+
+  void flush() {
+    spill();
+    settle();
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_OUTBUF_HH
@@ -0,0 +1,169 @@
+#ifndef LMDBTOOLS_PARALLEL_HH
+#define LMDBTOOLS_PARALLEL_HH
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace lmdbtools {
+
+/**
+ * Bounded blocking FIFO queue handing work items from one producer to a
+ * pool of worker threads.
+ */
+template<typename T>
+class work_queue {
+  std::mutex _mutex;
+  std::condition_variable _not_empty;
+  std::condition_variable _not_full;
+  std::deque<T> _items;
+  const std::size_t _capacity;
+  bool _closed{false};
+
+public:
+  explicit work_queue(const std::size_t capacity)
+    : _capacity{capacity ? capacity : 1} {}
+
+  /**
+   * Appends an item, blocking while the queue is full.
+   */
+  void push(T&& item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_full.wait(lock, [this] { return _items.size() < _capacity; });
+    _items.push_back(std::move(item));
+    _not_empty.notify_one();
+  }
+
+  /**
+   * Removes the oldest item, blocking while the queue is empty.
+   *
+   * @retval false if the queue is closed and drained
+   */
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [this] { return _closed || !_items.empty(); });
+    if (_items.empty()) return false;
+    item = std::move(_items.front());
+    _items.pop_front();
+    _not_full.notify_one();
+    return true;
+  }
+
+  /**
+   * Signals that no more items will be pushed.
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _not_empty.notify_all();
+  }
+};
+
+/**
+ * Reorder buffer that emits output produced out of order by worker threads
+ * strictly in sequence order.
+ *
+ * Each sequence number (slot) receives any number of chunks through
+ * `write()` and is finished by `done()`. `run()` passes the chunks of slot
+ * 0, 1, 2, ... to the sink as soon as they are available. A producer writing
+ * to any slot other than the one being emitted blocks while more than
+ * `limit` bytes are buffered, which bounds memory without deadlocking the
+ * producer the sink is waiting for.
+ */
+class ordered_output {
+public:
+  using sink_type = std::function<void(const std::string&)>;
+
+private:
+  struct slot {
+    std::deque<std::string> chunks;
+    bool done{false};
+  };
+
+  std::mutex _mutex;
+  std::condition_variable _ready;
+  std::condition_variable _drained;
+  std::map<std::size_t, slot> _slots;
+  sink_type _sink;
+  const std::size_t _limit;
+  std::size_t _buffered{0};
+  std::size_t _next{0};
+  std::size_t _end{static_cast<std::size_t>(-1)};
+
+public:
+  ordered_output(sink_type sink,
+                 const std::size_t limit)
+    : _sink{std::move(sink)},
+      _limit{limit} {}
+
+  /**
+   * Appends a chunk of output to slot `seq`.
+   */
+  void write(const std::size_t seq,
+             std::string&& chunk) {
+    if (chunk.empty()) return;
+    std::unique_lock<std::mutex> lock(_mutex);
+    _drained.wait(lock, [this, seq] {
+      return seq == _next || _buffered <= _limit;
+    });
+    _buffered += chunk.size();
+    _slots[seq].chunks.push_back(std::move(chunk));
+    if (seq == _next) _ready.notify_one();
+  }
+
+  /**
+   * Marks slot `seq` as complete.
+   */
+  void done(const std::size_t seq) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _slots[seq].done = true;
+    if (seq == _next) _ready.notify_one();
+  }
+
+  /**
+   * Declares `count` as the total number of slots; `run()` returns once
+   * all of them have been emitted.
+   */
+  void close(const std::size_t count) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _end = count;
+    _ready.notify_one();
+  }
+
+  /**
+   * Emits slots in order until the count given to `close()` is reached.
+   */
+  void run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_next < _end) {
+      auto it = _slots.find(_next);
+      if (it == _slots.end() || (it->second.chunks.empty() && !it->second.done)) {
+        _ready.wait(lock);
+        continue;
+      }
+      slot& s = it->second;
+      if (s.chunks.empty()) {  // finished slot
+        _slots.erase(it);
+        ++_next;
+        _drained.notify_all();
+        continue;
+      }
+      std::string chunk = std::move(s.chunks.front());
+      s.chunks.pop_front();
+      lock.unlock();
+      _sink(chunk);
+      lock.lock();
+      _buffered -= chunk.size();
+      _drained.notify_all();
+    }
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_PARALLEL_HH
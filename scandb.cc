@@ -1,41 +1,699 @@
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <libgen.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include "lmdb++.h"
+#include "bloom.hh"
+#include "keyschema.hh"
+#include "mdbpage.hh"
+#include "metadata.hh"
+#include "outbuf.hh"
+#include "parallel.hh"
+#include "valcodec.hh"
+
+namespace {
+
+// Kinds of queries a key file line can hold.
+enum class query {
+  exact,  // the entry of a key
+  prefix,  // all entries whose key starts with a prefix
+  range,  // all entries with keys in [lo, hi)
+};
+
+// How lookups over several databases combine their results.
+enum class layering {
+  first,  // the newest database holding a key wins
+  all,  // one value column per database
+};
+
+// Settings shared by all lookups.
+struct lookup_options {
+  std::regex pat;  // key pattern of key file lines
+  query mode;  // query kind
+  layering layers;  // combination of several databases
+  std::string separator;  // field separator
+  bool withkey;  // dump with key
+  bool valkeyorder;  // dump in value-key order
+  unsigned int inflight;  // interleaved lookups per block; 0: plain get
+  bool willneed;  // madvise(MADV_WILLNEED) the pages to be visited
+  const std::vector<lmdbtools::bloom_filter> *filters;  // one per database
+  lmdbtools::key_schema schema;  // key components; empty: raw keys
+  lmdbtools::comparator cmp;  // key order of all databases
+  std::vector<lmdbtools::value_codec> codecs;  // one per database
+};
+
+// Lookup counters summed over all lookups.
+struct lookup_stats {
+  std::atomic<uint64_t> lookups{0};
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> filtered{0};  // answered by the filters alone
+};
+
+// Looks up the keys of key file lines in one or more databases, each
+// within its own read-only transaction, and appends the formatted records
+// to an output buffer.
+class lookup {
+  // Read-only view of one database.
+  struct layer {
+    lmdb::txn rtxn;
+    lmdb::dbi dbi;
+    lmdb::cursor cursor;
+    lmdb::val key;  // current cursor position of a scan
+    lmdb::val val;
+    bool live;  // whether the position is within the scanned range
+    const lmdbtools::bloom_filter *sidecar;  // filter file of the database
+    const lmdbtools::bloom_filter *filter;  // the sidecar if it is fresh
+    lmdbtools::value_codec codec;  // decoder of the values
+
+    layer(MDB_env *env, const lmdbtools::bloom_filter *f,
+          const lmdbtools::comparator &cmp,
+          const lmdbtools::value_codec &c)
+      : rtxn(lmdb::txn::begin(env, nullptr, MDB_RDONLY)),
+        dbi(lmdb::dbi::open(rtxn)),
+        cursor(lmdb::cursor::open(rtxn, dbi)),
+        key(), val(), live(false), sidecar(f), filter(nullptr), codec(c) {
+      cmp.apply(rtxn, dbi);
+      check_filter();
+    }
+
+    // Uses the filter only while it was built from the current snapshot.
+    void check_filter() {
+      filter = (sidecar && !sidecar->empty()
+                && sidecar->stamp() == lmdbtools::filter_stamp::of(rtxn, dbi))
+        ? sidecar : nullptr;
+    }
+
+    // Whether the database may hold a key.
+    bool may_contain(const lmdb::val &k) const {
+      return !filter || filter->may_contain(k.data(), k.size());
+    }
+  };
+
+  std::vector<layer> _layers;  // oldest database first
+  const lookup_options &_opts;
+  lookup_stats &_stats;
+  lmdbtools::mdbpage::tree _tree;
+  const size_t _pagesize;
+  std::smatch _match;
+  std::vector<std::string> _keys;  // keys of the current block
+  std::vector<lmdb::val> _values;  // their values; null data if missing
+  std::string _decoded;  // value being emitted
+  uint64_t _lookups = 0;
+  uint64_t _hits = 0;
+  uint64_t _filtered = 0;
+  std::chrono::steady_clock::time_point _renewed;
+
+  int compare(const lmdb::val &a, const lmdb::val &b) {
+    return mdb_cmp(_layers.front().rtxn, _layers.front().dbi, a, b);
+  }
+
+  // Encodes the key text of a query with the key schema, if any; a prefix
+  // or a range bound may hold the leading components only. False if the
+  // text does not fit the schema.
+  bool encode(const std::string &text, std::string &key, bool prefix = false) {
+    if (_opts.schema.empty()) {
+      key = text;
+      return true;
+    }
+    try {
+      _opts.schema.encode(text.data(), text.size(), key, prefix);
+    }
+    catch (const std::runtime_error &) {
+      return false;
+    }
+    return true;
+  }
+
+  // Appends a key, as component text if it has a schema.
+  void append_key(const lmdb::val &k, std::string &out) {
+    if (_opts.schema.empty()) {
+      out.append(k.data(), k.size());
+    } else {
+      _opts.schema.decode(k.data(), k.size(), out);
+    }
+  }
+
+  // Emits an entry, decoding its value only now that it is output.
+  void emit(const lmdb::val &k, const lmdb::val &stored,
+            lmdbtools::value_codec &codec, std::string &out) {
+    const lmdb::val v = codec.decode(stored, _decoded);
+    if (_opts.withkey && _opts.valkeyorder) {
+      out.append(v.data(), v.size()).append(_opts.separator);
+      append_key(k, out);
+    } else if (_opts.withkey && !_opts.valkeyorder) {
+      append_key(k, out);
+      out.append(_opts.separator).append(v.data(), v.size());
+    } else {
+      out.append(v.data(), v.size());
+    }
+    out += '\n';
+  }
+
+  // Emits one value column per database, empty where a database does not
+  // hold the key.
+  void emit_columns(const lmdb::val &k, std::string &out) {
+    if (_opts.withkey && !_opts.valkeyorder) {
+      append_key(k, out);
+    }
+    for (size_t i = 0; i < _values.size(); ++i) {
+      if (i > 0 || (_opts.withkey && !_opts.valkeyorder)) {
+        out.append(_opts.separator);
+      }
+      if (_values[i].data()) {
+        const lmdb::val v = _layers[i].codec.decode(_values[i], _decoded);
+        out.append(v.data(), v.size());
+      }
+    }
+    if (_opts.withkey && _opts.valkeyorder) {
+      out.append(_opts.separator);
+      append_key(k, out);
+    }
+    out += '\n';
+  }
+
+  // Emits the entries from the first key not less than `lo` on, for as
+  // long as `in_range` holds for their keys. The cursors of all databases
+  // are merged in key order.
+  template<typename F>
+  void scan(const std::string &lo, F in_range, std::string &out) {
+    ++_lookups;
+    for (auto &l : _layers) {
+      l.key = lmdb::val{lo};
+      l.live = l.cursor.get(l.key, l.val, lo.empty() ? MDB_FIRST : MDB_SET_RANGE)
+        && in_range(l.key);
+    }
+    bool hit = false;
+    for (;;) {
+      layer *least = nullptr;
+      for (auto &l : _layers) {
+        if (l.live && (!least || compare(l.key, least->key) < 0)) {
+          least = &l;
+        }
+      }
+      if (!least) break;
+      hit = true;
+      const lmdb::val k{least->key.data(), least->key.size()};
+      if (_opts.layers == layering::first) {
+        for (auto l = _layers.rbegin(); l != _layers.rend(); ++l) {
+          if (l->live && compare(l->key, k) == 0) {
+            emit(k, l->val, l->codec, out);
+            break;
+          }
+        }
+      } else {
+        for (size_t i = 0; i < _layers.size(); ++i) {
+          const layer &l = _layers[i];
+          if (l.live && compare(l.key, k) == 0) {
+            _values[i].assign(l.val.data(), l.val.size());
+          } else {
+            _values[i] = lmdb::val{nullptr, 0};
+          }
+        }
+        emit_columns(k, out);
+      }
+      for (size_t i = 0; i < _layers.size(); ++i) {
+        layer &l = _layers[i];
+        if (l.live && (&l == least || compare(l.key, k) == 0)) {
+          l.live = l.cursor.get(l.key, l.val, MDB_NEXT) && in_range(l.key);
+        }
+      }
+    }
+    if (hit) {
+      ++_hits;
+    }
+  }
+
+  // Looks up a key in the newest database holding it, skipping the
+  // databases whose filter rules the key out, and returns that database,
+  // or nullptr if none holds the key.
+  layer *get(const std::string &key, lmdb::val &v) {
+    const lmdb::val k{key.data(), key.size()};
+    ++_lookups;
+    bool touched = false;
+    for (auto l = _layers.rbegin(); l != _layers.rend(); ++l) {
+      if (!l->may_contain(k))
+        continue;
+      touched = true;
+      if (l->dbi.get(l->rtxn, k, v)) {
+        ++_hits;
+        return &*l;
+      }
+    }
+    if (!touched) {
+      ++_filtered;
+    }
+    return nullptr;
+  }
+
+  // Looks up a key in every database.
+  void get_all(const std::string &key, std::string &out) {
+    const lmdb::val k{key.data(), key.size()};
+    ++_lookups;
+    bool hit = false;
+    bool touched = false;
+    for (size_t i = 0; i < _layers.size(); ++i) {
+      if (_layers[i].may_contain(k)) {
+        touched = true;
+        if (_layers[i].dbi.get(_layers[i].rtxn, k, _values[i])) {
+          hit = true;
+          continue;
+        }
+      }
+      _values[i] = lmdb::val{nullptr, 0};
+    }
+    if (!touched) {
+      ++_filtered;
+    }
+    if (hit) {
+      ++_hits;
+      emit_columns(k, out);
+    }
+  }
+
+  // Starts loading page `pgno` into the CPU cache and, if requested, from
+  // storage, without waiting for it.
+  void prefetch(size_t pgno) {
+    if (pgno > _tree.last_pgno())
+      return;
+    const char *page = _tree.map() + pgno * _tree.psize();
+    if (_opts.willneed) {
+      const auto addr = reinterpret_cast<uintptr_t>(page);
+      madvise(reinterpret_cast<void *>(addr - addr % _pagesize),
+              _tree.psize(), MADV_WILLNEED);
+    }
+    __builtin_prefetch(page);
+    __builtin_prefetch(page + 64);
+  }
+
+  // Walks up to `inflight` lookups of the block down the B-tree in turns.
+  // Each step finds the child page one lookup visits next and prefetches
+  // it before moving on to the other lookups, so their page faults and
+  // cache misses overlap. Once a lookup reaches its leaf its path is warm
+  // and the value is fetched with mdb_get.
+  void interleave() {
+    struct slot {
+      size_t index;
+      size_t pgno;
+      unsigned int level;
+    };
+    std::vector<slot> slots;
+    size_t next = 0;
+    auto start = [&](slot &s) {
+      for (; next < _keys.size(); ++next) {
+        const lmdb::val k{_keys[next].data(), _keys[next].size()};
+        if (_layers[0].may_contain(k))
+          break;
+        ++_lookups;  // ruled out by the filter without a descent
+        ++_filtered;
+        _values[next] = lmdb::val{nullptr, 0};
+      }
+      if (next >= _keys.size())
+        return false;
+      s = slot{next++, _tree.root(), 0};
+      prefetch(s.pgno);
+      return true;
+    };
+    for (slot s; slots.size() < _opts.inflight && start(s);) {
+      slots.push_back(s);
+    }
+    while (!slots.empty()) {
+      for (size_t j = 0; j < slots.size();) {
+        slot &s = slots[j];
+        const char *page = _tree.page(s.pgno);
+        if (page && lmdbtools::mdbpage::is_branch(page)
+            && s.level < lmdbtools::mdbpage::max_depth) {
+          const std::string &key = _keys[s.index];
+          const MDB_val k{key.size(), const_cast<char *>(key.data())};
+          s.pgno = _tree.child(page, k);
+          ++s.level;
+          prefetch(s.pgno);
+          ++j;
+          continue;
+        }
+        if (!get(_keys[s.index], _values[s.index])) {
+          _values[s.index] = lmdb::val{nullptr, 0};
+        }
+        if (!start(s)) {
+          slots[j] = slots.back();
+          slots.pop_back();
+        }
+      }
+    }
+  }
+
+  // The interleaved engine walks a single B-tree.
+  bool interleaved() const {
+    return _opts.mode == query::exact && _layers.size() == 1
+      && _opts.inflight > 0 && _tree.valid();
+  }
+
+public:
+  lookup(const std::vector<MDB_env *> &envs, const lookup_options &opts,
+         lookup_stats &stats)
+    : _opts(opts),
+      _stats(stats),
+      _pagesize(sysconf(_SC_PAGESIZE)),
+      _renewed(std::chrono::steady_clock::now()) {
+    _layers.reserve(envs.size());
+    for (size_t i = 0; i < envs.size(); ++i) {
+      _layers.emplace_back(envs[i], opts.filters ? &(*opts.filters)[i] : nullptr,
+                           opts.cmp, opts.codecs[i]);
+    }
+    if (_layers.size() == 1 && opts.inflight > 0) {
+      _tree = lmdbtools::mdbpage::tree(_layers[0].rtxn, _layers[0].dbi);
+    }
+  }
+
+  ~lookup() {
+    _stats.lookups += _lookups;
+    _stats.hits += _hits;
+    _stats.filtered += _filtered;
+  }
+
+  // Moves the snapshots forward to the latest committed transactions when
+  // they are older than the given interval.
+  void refresh(std::chrono::milliseconds interval) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - _renewed < interval)
+      return;
+    for (auto &l : _layers) {
+      l.rtxn.reset();
+      l.rtxn.renew();
+      l.cursor.renew(l.rtxn);
+      l.check_filter();
+    }
+    if (_layers.size() == 1 && _opts.inflight > 0) {
+      _tree = lmdbtools::mdbpage::tree(_layers[0].rtxn, _layers[0].dbi);
+    }
+    _renewed = now;
+  }
+
+  void operator()(const std::string &line, std::string &out) {
+    if (!std::regex_match(line, _match, _opts.pat))
+      return;
+    if (_match.size() <= 1)
+      return;
+    _values.resize(_layers.size());
+    switch (_opts.mode) {
+      case query::exact: {
+        std::string key;
+        if (!encode(_match.str(1), key))
+          return;
+        lmdb::val v;
+        if (_opts.layers == layering::all) {
+          get_all(key, out);
+        } else if (layer *l = get(key, v)) {
+          emit(lmdb::val{key}, v, l->codec, out);
+        }
+        break;
+      }
+      case query::prefix: {
+        std::string prefix;
+        if (!encode(_match.str(1), prefix, true))
+          return;
+        scan(prefix, [&prefix](const lmdb::val &k) {
+          return k.size() >= prefix.size()
+            && std::memcmp(k.data(), prefix.data(), prefix.size()) == 0;
+        }, out);
+        break;
+      }
+      case query::range: {
+        std::string lo, hi;
+        if (!encode(_match.str(1), lo, true)
+            || !encode(_match.size() > 2 ? _match.str(2) : "", hi, true))
+          return;
+        const lmdb::val h{hi};
+        scan(lo, [this, &h](const lmdb::val &k) {
+          return h.empty() || compare(k, h) < 0;
+        }, out);
+        break;
+      }
+    }
+  }
+
+  void operator()(const std::vector<std::string> &lines, std::string &out) {
+    if (!interleaved()) {
+      for (const auto &line : lines) {
+        (*this)(line, out);
+      }
+      return;
+    }
+    _keys.clear();
+    for (const auto &line : lines) {
+      if (std::regex_match(line, _match, _opts.pat) && _match.size() > 1) {
+        _keys.emplace_back();
+        if (!encode(_match.str(1), _keys.back())) {
+          _keys.pop_back();
+        }
+      }
+    }
+    _values.resize(_keys.size());
+    interleave();
+    for (size_t i = 0; i < _keys.size(); ++i) {
+      if (_values[i].data()) {
+        emit(lmdb::val{_keys[i]}, _values[i], _layers[0].codec, out);
+      }
+    }
+  }
+};
+
+// Pool of idle lookups shared by the connections of the server mode.
+class lookup_pool {
+  std::mutex _mutex;
+  std::condition_variable _idle_cv;
+  std::vector<std::unique_ptr<lookup>> _idle;
+
+public:
+  // Borrowed lookup, returned to the pool on destruction.
+  class lease {
+    lookup_pool &_pool;
+    std::unique_ptr<lookup> _lookup;
+
+  public:
+    lease(lookup_pool &pool, std::unique_ptr<lookup> l)
+      : _pool(pool), _lookup(std::move(l)) {}
+    lease(lease &&other) = default;
+    ~lease() { if (_lookup) _pool.release(std::move(_lookup)); }
+    lookup &operator*() const { return *_lookup; }
+    lookup *operator->() const { return _lookup.get(); }
+  };
+
+  void release(std::unique_ptr<lookup> l) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _idle.push_back(std::move(l));
+    _idle_cv.notify_one();
+  }
+
+  lease acquire() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle_cv.wait(lock, [this] { return !_idle.empty(); });
+    std::unique_ptr<lookup> l = std::move(_idle.back());
+    _idle.pop_back();
+    return lease(*this, std::move(l));
+  }
+};
+
+bool read_full(int fd, char *buf, size_t size) {
+  while (size > 0) {
+    const ssize_t n = ::read(fd, buf, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool write_full(int fd, const char *buf, size_t size) {
+  while (size > 0) {
+    const ssize_t n = ::write(fd, buf, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Largest request payload; a client asking for more is dropped rather than
+// allowed to make the server allocate it.
+constexpr uint32_t max_request = 16UL << 20;
+
+// A frame is a 4-byte big-endian payload length followed by the payload.
+bool read_frame(int fd, std::string &payload) {
+  unsigned char header[4];
+  if (!read_full(fd, reinterpret_cast<char *>(header), sizeof(header)))
+    return false;
+  const uint32_t size = (uint32_t(header[0]) << 24) |
+    (uint32_t(header[1]) << 16) | (uint32_t(header[2]) << 8) | header[3];
+  if (size > max_request)
+    return false;
+  payload.resize(size);
+  return read_full(fd, &payload[0], size);
+}
+
+bool write_frame(int fd, const std::string &payload) {
+  if (payload.size() > UINT32_MAX)
+    return false;
+  const uint32_t size = payload.size();
+  const unsigned char header[4] = {
+    static_cast<unsigned char>(size >> 24),
+    static_cast<unsigned char>(size >> 16),
+    static_cast<unsigned char>(size >> 8),
+    static_cast<unsigned char>(size) };
+  return write_full(fd, reinterpret_cast<const char *>(header), sizeof(header))
+    && write_full(fd, payload.data(), payload.size());
+}
+
+// Answers request frames of newline separated key lines read from `in`
+// with response frames of lookup output written to `out`, until either
+// side is closed or a request is too large.
+void serve(int in, int out, lookup_pool &pool,
+           std::chrono::milliseconds interval) {
+  std::string request, response;
+  std::vector<std::string> lines;
+  while (read_frame(in, request)) {
+    lines.clear();
+    for (size_t pos = 0; pos < request.size();) {
+      size_t eol = request.find('\n', pos);
+      if (eol == std::string::npos) eol = request.size();
+      lines.emplace_back(request, pos, eol - pos);
+      pos = eol + 1;
+    }
+    response.clear();
+    {
+      auto get = pool.acquire();
+      get->refresh(interval);
+      (*get)(lines, response);
+    }
+    if (!write_frame(out, response))
+      break;
+  }
+}
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
   using namespace std;
 
+  const size_t blocklines = 4096;  // key lines per work block
+  const size_t outlimit = 64UL * 1024UL * 1024UL;  // reorder buffer limit
+
   int verbose = 0;  // verbose output
+  unsigned int nthreads = 1;  // number of lookup threads
+  const int max_threads = 1024;  // bound of -j
+  string socketname = "";  // serve lookups on this socket
+  uint64_t renewms = 1000;  // snapshot renewal interval of the server
+  unsigned int inflight = 0;  // interleaved lookups; 0: plain lookups
+  bool willneed = false;  // madvise the pages of interleaved lookups
+  bool usefilter = true;  // consult the negative-lookup filters
   string separator = "\t";  // field separator
-  string pattern = R"(^(\S+).*)";
+  string pattern = "";  // key pattern; default depends on the query kind
+  string exactpattern = R"(^(\S+).*)";
+  string rangepattern = R"(^(\S+)\s+(\S*).*)";
+  query mode = query::exact;  // query kind
+  vector<string> layerdbfnames;  // databases layered over <dbname>
+  layering layers = layering::first;  // combination of the databases
   bool withkey = true;  // dump with key
   bool valkeyorder = false;  // dump database value-key order
+  lmdbtools::key_schema schema;  // key components
 
   string progname = basename(argv[0]);
   string usage = "usage: " + progname +
     " [options] <dbname> [<keyfile> ...]\n"
     "options: -p           regular expression pattern for key\n"
-    "                      default pattern is \"" + pattern + "\"\n"
+    "                      default pattern is \"" + exactpattern + "\"\n"
+    "                      or \"" + rangepattern + "\" for -q range\n"
+    "         -q <kind>    query kind: exact (default), prefix: entries\n"
+    "                      whose key starts with the key, range: entries\n"
+    "                      with keys in [<1st group>, <2nd group>);\n"
+    "                      an empty upper bound is unbounded\n"
+    "         -d <dbname>  layer a newer database over the preceding ones\n"
+    "                      (repeatable)\n"
+    "         -L <mode>    combination of layered databases: first: the\n"
+    "                      newest database holding a key wins (default),\n"
+    "                      all: one value column per database\n"
     "         -k           dump with key\n"
     "         -r           dump database in value-key reverse order\n"
     "         -s <string>  field separator\n"
-    "         -v           verbose output\n"
+    "         -j <num>     number of lookup threads (1), at most "
+    + to_string(max_threads) + "; 0: all cores\n"
+    "         -S <path>    serve lookups on a unix domain socket;\n"
+    "                      \"-\" serves on stdin/stdout\n"
+    "         -R <msec>    server snapshot renewal interval ("
+    + to_string(renewms) + ")\n"
+    "         -I <num>     interleave <num> lookups with page prefetching\n"
+    "         -W           also madvise(MADV_WILLNEED) interleaved pages\n"
+    "         -F           ignore the negative-lookup filters <dbname>-filter\n"
+    "                      built by filterdb\n"
+    "         -t <schema>  keys stored by makedb -t <schema>: queries and\n"
+    "                      output keys are comma separated components, and\n"
+    "                      prefixes and range bounds may hold the leading\n"
+    "                      components only\n"
+    "         -v           verbose output"
+    + string(lmdb::instrument::enabled
+             ? "; -vv adds lmdb call statistics\n" : "\n")
+    + "server frames are a 4-byte big-endian length followed by the payload;\n"
+    "a request holds key lines, at most "
+    + to_string(max_request >> 20) + " MiB, its response the lookup output\n"
     ;
   for (opterr = 0;;) {
-    int opt = getopt(argc, argv, ":p:krs:v");
+    int opt = getopt(argc, argv, ":p:q:d:L:krs:j:S:R:I:WFt:v");
     if (opt == -1) break;
     try {
       switch (opt) {
         case 'p': { pattern = optarg; break; }
+        case 'q': { const string q = optarg;
+                    if (q == "exact") mode = query::exact;
+                    else if (q == "prefix") mode = query::prefix;
+                    else if (q == "range") mode = query::range;
+                    else throw invalid_argument(q);
+                    break;
+                  }
+        case 'd': { layerdbfnames.push_back(optarg); break; }
+        case 'L': { const string l = optarg;
+                    if (l == "first") layers = layering::first;
+                    else if (l == "all") layers = layering::all;
+                    else throw invalid_argument(l);
+                    break;
+                  }
         case 'k': { withkey = true; break; }
         case 'r': { valkeyorder = true; break; }
         case 's': { separator = optarg; break; }
+        case 'j': { const int n = stoi(optarg);
+                    if (n < 0 || n > max_threads) throw 0;
+                    nthreads = n;
+                    break; }
+        case 'S': { socketname = optarg; break; }
+        case 'R': { renewms = stoul(optarg); break; }
+        case 'I': { inflight = stoul(optarg); break; }
+        case 'W': { willneed = true; break; }
+        case 'F': { usefilter = false; break; }
+        case 't': { schema = lmdbtools::key_schema(optarg); break; }
         case 'v': { ++verbose; break; }
         case ':': { cout << "missing argument of -"
                     << static_cast<char>(optopt) << endl;
@@ -57,60 +715,282 @@ int main(int argc, char *argv[]) {
     cout << "too few arguments\n" << usage << flush;
     exit(EXIT_FAILURE);
   }
+  if (verbose > 1) {
+    lmdb::instrument::print_at_exit();
+  }
+  if (!socketname.empty() && argc - optind > 1) {
+    cout << "key files cannot be given with -S\n" << usage << flush;
+    exit(EXIT_FAILURE);
+  }
+  if (pattern.empty()) {
+    pattern = (mode == query::range ? rangepattern : exactpattern);
+  }
+  if (nthreads == 0) {
+    nthreads = max(1U, thread::hardware_concurrency());
+  }
 
   int oi = optind;
-  string idbfname(argv[oi++]);
+  vector<string> idbfnames{argv[oi++]};
+  idbfnames.insert(idbfnames.end(), layerdbfnames.begin(), layerdbfnames.end());
 
-  cout.sync_with_stdio(false);
+  lmdbtools::output_writer sink(STDOUT_FILENO);
 
   try {
     if (verbose > 0) {
       cerr << "pattern: " << pattern << endl;
-      cerr << idbfname << endl;
-    }
-    auto env = lmdb::env::create();
-    env.set_mapsize(0);
-    env.open(idbfname.c_str(), MDB_NOSUBDIR | MDB_NOLOCK | MDB_RDONLY);
-
-    auto rtxn   = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
-    auto dbi    = lmdb::dbi::open(rtxn);
-
-    string linefmt = (withkey
-        ? (valkeyorder ? "{2}{1}{0}\n" : "{0}{1}{2}\n")
-        : "{2}\n");
-
-    smatch match;
-    regex pat(pattern);
-
-    for (int i = oi; i < argc; ++i) {
-      if (verbose > 1) {
-        cerr << "? " << argv[i] << endl;
-      }
-      ifstream ifs(argv[i]);
-      for (string line; getline(ifs, line);) {
-        if (regex_match(line, match, pat)) {
-          if (match.size() <= 1)
-            continue;
-          const string &key = (match.size() >= 1 ? match.str(1) : "");
-          const lmdb::val k{key.data(), key.size()};
-          lmdb::val v;
-          if (dbi.get(rtxn, k, v)) {
-            const string value(v.data(), v.size());
-            if (withkey && valkeyorder) {
-              cout << value << separator << key << '\n';
-            } else if (withkey && !valkeyorder) {
-              cout << key << separator << value << '\n';
-            } else {
-              cout << value << '\n';
-            }
+    }
+    // a long-running server registers its snapshots in the lock table so
+    // that writers do not reuse the pages it is reading
+    vector<lmdb::env> envs;
+    vector<MDB_env *> envhandles;
+    for (const auto &idbfname : idbfnames) {
+      if (verbose > 0) {
+        cerr << idbfname << endl;
+      }
+      auto env = lmdb::env::create();
+      env.set_mapsize(0);
+      env.open(idbfname.c_str(), MDB_NOSUBDIR | MDB_NOTLS | MDB_RDONLY
+          | (socketname.empty() ? MDB_NOLOCK : 0));
+      envhandles.push_back(env);
+      envs.push_back(move(env));
+    }
+
+    // filters only answer exact lookups; a stale one is ignored per snapshot
+    vector<lmdbtools::bloom_filter> filters(idbfnames.size());
+    if (usefilter && mode == query::exact) {
+      for (size_t i = 0; i < idbfnames.size(); ++i) {
+        const string path = lmdbtools::bloom_filter::path_of(idbfnames[i]);
+        if (filters[i].load(path) && verbose > 0) {
+          cerr << "filter: " << path << endl;
+        }
+      }
+    }
+
+    // the layers are scanned together in one key order, in which a prefix
+    // can only be sought if the keys sharing it are adjacent
+    const auto cmp = lmdbtools::comparator::of(idbfnames[0]);
+    for (size_t i = 1; i < idbfnames.size(); ++i) {
+      const auto other = lmdbtools::comparator::of(idbfnames[i]);
+      if (other != cmp) {
+        throw runtime_error(idbfnames[i] + ": comparator mismatch: "
+                            + other.name() + " != " + cmp.name());
+      }
+    }
+    if (mode == query::prefix && !cmp.bytewise()) {
+      throw runtime_error(idbfnames[0] + ": prefix queries need a bytewise "
+                          "key order, not " + cmp.name());
+    }
+    vector<lmdbtools::value_codec> codecs;
+    for (const auto &idbfname : idbfnames) {
+      codecs.push_back(lmdbtools::value_codec::of(idbfname));
+    }
+
+    const lookup_options opts{regex(pattern), mode, layers, separator, withkey,
+                              valkeyorder, inflight, willneed, &filters,
+                              schema, cmp, codecs};
+    lookup_stats stats;
+
+    if (!socketname.empty()) {
+      lookup_pool pool;
+      for (unsigned int t = 0; t < nthreads; ++t) {
+        pool.release(unique_ptr<lookup>(new lookup(envhandles, opts, stats)));
+      }
+      const chrono::milliseconds interval(renewms);
+
+      if (socketname == "-") {
+        serve(STDIN_FILENO, STDOUT_FILENO, pool, interval);
+        return EXIT_SUCCESS;
+      }
+
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (socketname.size() >= sizeof(addr.sun_path)) {
+        cerr << socketname << ": socket path too long" << endl;
+        return EXIT_FAILURE;
+      }
+      socketname.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+      struct stat st;
+      if (lstat(socketname.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socketname.c_str());  // stale socket of a previous server
+      }
+      const int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (sfd < 0
+          || bind(sfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0
+          || listen(sfd, SOMAXCONN) < 0) {
+        cerr << socketname << ": " << strerror(errno) << endl;
+        return EXIT_FAILURE;
+      }
+      signal(SIGPIPE, SIG_IGN);
+      if (verbose > 0) {
+        cerr << "listening on " << socketname << endl;
+      }
+
+      // the connections borrow lookups from the pool, so they are shut
+      // down and waited for before the server returns
+      mutex conn_mutex;
+      condition_variable conn_cv;
+      set<int> conns;
+      for (;;) {
+        const int fd = accept(sfd, nullptr, nullptr);
+        if (fd < 0) {
+          if (errno == EINTR || errno == ECONNABORTED) continue;
+          cerr << socketname << ": " << strerror(errno) << endl;
+          unique_lock<mutex> lock(conn_mutex);
+          for (const int c : conns) {
+            shutdown(c, SHUT_RDWR);
           }
+          conn_cv.wait(lock, [&conns] { return conns.empty(); });
+          return EXIT_FAILURE;
+        }
+        {
+          lock_guard<mutex> lock(conn_mutex);
+          conns.insert(fd);
         }
+        thread([fd, &pool, interval, &conn_mutex, &conn_cv, &conns]() {
+          try {
+            serve(fd, fd, pool, interval);
+          }
+          catch (const runtime_error &e) {
+            cerr << e.what() << endl;
+          }
+          // closed under the lock, so that a shutdown never hits a reused
+          // descriptor
+          lock_guard<mutex> lock(conn_mutex);
+          close(fd);
+          conns.erase(fd);
+          conn_cv.notify_all();
+        }).detach();
       }
     }
-    rtxn.abort();
+
+    // reads the key files in blocks of lines
+    auto read_blocks = [&](const function<void(vector<string> &&)> &f) {
+      vector<string> lines;
+      for (int i = oi; i < argc; ++i) {
+        if (verbose > 1) {
+          cerr << "? " << argv[i] << endl;
+        }
+        ifstream ifs(argv[i]);
+        for (string line; getline(ifs, line);) {
+          lines.push_back(move(line));
+          if (lines.size() >= blocklines) {
+            f(move(lines));
+            lines.clear();
+          }
+        }
+      }
+      if (!lines.empty()) {
+        f(move(lines));
+      }
+    };
+
+    const auto start = chrono::steady_clock::now();
+
+    if (nthreads == 1) {
+      lookup get(envhandles, opts, stats);
+      string out;
+      read_blocks([&](vector<string> &&lines) {
+        get(lines, out);
+        sink.append(out);
+        out.clear();
+      });
+    } else {
+      // split the key stream into sequenced blocks, look them up on worker
+      // threads each with its own read-only transaction, and write the
+      // results back in input order
+      struct block {
+        size_t seq;
+        vector<string> lines;
+      };
+      mutex failure_mutex;
+      exception_ptr failure;
+      auto fail = [&]() {
+        lock_guard<mutex> lock(failure_mutex);
+        if (!failure) failure = current_exception();
+      };
+
+      // a failed write drops the rest of the output so that the workers
+      // still drain
+      bool broken = false;
+      lmdbtools::work_queue<block> queue(2 * nthreads);
+      lmdbtools::ordered_output output(
+          [&](const string &s) {
+            if (broken) return;
+            try {
+              sink.append(s);
+            }
+            catch (...) { fail(); broken = true; }
+          }, outlimit);
+
+      vector<thread> workers;
+      thread writer;
+      try {
+        for (unsigned int t = 0; t < nthreads; ++t) {
+          workers.emplace_back([&]() {
+            unique_ptr<lookup> get;
+            try {
+              get.reset(new lookup(envhandles, opts, stats));
+            }
+            catch (...) { fail(); }
+            for (block b; queue.pop(b);) {
+              string out;
+              if (get) {
+                try {
+                  (*get)(b.lines, out);
+                }
+                catch (...) { fail(); get.reset(); }
+              }
+              output.write(b.seq, move(out));
+              output.done(b.seq);
+            }
+          });
+        }
+        writer = thread([&]() { output.run(); });
+      }
+      catch (...) {
+        // the started workers find the queue closed and return
+        queue.close();
+        for (auto &w : workers) w.join();
+        throw;
+      }
+
+      size_t seq = 0;
+      read_blocks([&](vector<string> &&lines) {
+        queue.push(block{seq++, move(lines)});
+      });
+      queue.close();
+      output.close(seq);
+
+      for (auto &w : workers) w.join();
+      writer.join();
+      if (failure) rethrow_exception(failure);
+    }
+
+    if (verbose > 0) {
+      const chrono::duration<double> elapsed =
+        chrono::steady_clock::now() - start;
+      const uint64_t lookups = stats.lookups;
+      const uint64_t hits = stats.hits;
+      const uint64_t filtered = stats.filtered;
+      cerr << "lookups " << lookups << " hits " << hits << " ("
+        << (lookups ? 100.0 * hits / lookups : 0.0) << "%) filtered "
+        << filtered << " ("
+        << (lookups ? 100.0 * filtered / lookups : 0.0) << "%) in "
+        << elapsed.count() << " s, "
+        << (elapsed.count() > 0 ? lookups / elapsed.count() : 0.0)
+        << " lookups/s ("
+        << (inflight > 0 ? "interleaved " + to_string(inflight) : "plain get")
+        << ")" << endl;
+    }
+    sink.flush();
   }
   catch (const lmdb::error &e) {
-    cout << flush;
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  catch (const system_error &e) {
     cerr << e.what() << endl;
     return EXIT_FAILURE;
   }
@@ -118,5 +998,9 @@ int main(int argc, char *argv[]) {
     cerr << e.what() << ": pattern: " << pattern << endl;
     return EXIT_FAILURE;
   }
+  catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
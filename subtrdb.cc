@@ -1,10 +1,15 @@
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <libgen.h>
 #include <unistd.h>
 #include "lmdb++.h"
+#include "bloom.hh"
+#include "metadata.hh"
+#include "valcodec.hh"
 
 int main(int argc, char *argv[]) {
   using namespace std;
@@ -12,20 +17,26 @@ int main(int argc, char *argv[]) {
   uint64_t mapsize = 1024UL * 1024UL;  // lmdb map size in MiB
   int verbose = 0;  // verbose output
   bool checkvaluetoo = false;  // check not only the key but also its value
+  bool usefilter = true;  // consult the negative-lookup filter of <targetdb>
 
   string progname = basename(argv[0]);
   string usage = "usage: " + progname +
     " [options] <targetdb> [<dbname> ...]\n"
     "options: -x         check not only the key but also its value\n"
+    "         -F         ignore the negative-lookup filter <targetdb>-filter\n"
+    "                    built by filterdb\n"
     "         -m <size>  lmdb map size in MiB (" + to_string(mapsize) + ")\n"
-    "         -v         verbose output\n"
+    "         -v         verbose output"
+    + string(lmdb::instrument::enabled
+             ? "; -vv adds lmdb call statistics\n" : "\n")
     ;
   for (opterr = 0;;) {
-    int opt = getopt(argc, argv, ":xm:v");
+    int opt = getopt(argc, argv, ":xFm:v");
     if (opt == -1) break;
     try {
       switch (opt) {
         case 'x': { checkvaluetoo = true; break; }
+        case 'F': { usefilter = false; break; }
         case 'm': { mapsize = stoul(optarg); break; }
         case 'v': { ++verbose; break; }
         case ':': { cout << "missing argument of -"
@@ -48,6 +59,9 @@ int main(int argc, char *argv[]) {
     cout << "too few arguments\n" << usage << flush;
     exit(EXIT_FAILURE);
   }
+  if (verbose > 1) {
+    lmdb::instrument::print_at_exit();
+  }
 
   int oi = optind;
   string tdbfname(argv[oi++]);
@@ -57,12 +71,38 @@ int main(int argc, char *argv[]) {
     env0.set_mapsize(mapsize * 1024UL * 1024UL);
     env0.open(tdbfname.c_str(), MDB_NOSUBDIR | MDB_NOLOCK);
 
-    auto wtxn0 = lmdb::txn::begin(env0, nullptr);
-    auto dbi0  = lmdb::dbi::open(wtxn0);
+    // deleting keys keeps the filter a superset of the keys, so a filter
+    // fresh before the deletions is still valid after them
+    const string filterfname = lmdbtools::bloom_filter::path_of(tdbfname);
+    lmdbtools::bloom_filter filter;
+    if (usefilter && filter.load(filterfname)) {
+      auto rtxn0 = lmdb::txn::begin(env0, nullptr, MDB_RDONLY);
+      auto dbi0  = lmdb::dbi::open(rtxn0);
+      if (!(filter.stamp() == lmdbtools::filter_stamp::of(rtxn0, dbi0))) {
+        filter = lmdbtools::bloom_filter();
+      }
+      rtxn0.abort();
+    }
+
+    // the deletions are sorted and committed in one transaction
+    lmdb::batch_writer writer0(env0);
+    lmdbtools::comparator::of(tdbfname).apply(writer0);
 
     if (verbose > 0) {
       cerr << tdbfname << endl;
     }
+    if (verbose > 0 && !filter.empty()) {
+      cerr << "filter: " << filterfname << endl;
+    }
+    auto codec0 = lmdbtools::value_codec::of(tdbfname);
+    string buf0, buf;  // decoded values
+    uint64_t filtered = 0;
+    auto may_contain = [&](const lmdb::val &k) {
+      if (filter.empty() || filter.may_contain(k.data(), k.size()))
+        return true;
+      ++filtered;
+      return false;
+    };
 
     for (int i = oi; i < argc; ++i) {
       if (verbose > 0) {
@@ -74,37 +114,57 @@ int main(int argc, char *argv[]) {
 
       auto rtxn   = lmdb::txn::begin(env, nullptr, MDB_RDONLY);
       auto dbi    = lmdb::dbi::open(rtxn);
+      lmdbtools::comparator::of(argv[i]).apply(rtxn, dbi);
+      auto codec = lmdbtools::value_codec::of(argv[i]);
 
+      // values equal as stored with the same dictionary are equal, and
+      // others are compared decoded
+      const bool same = codec == codec0;
+      auto equal = [](const lmdb::val &a, const lmdb::val &b) {
+        return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+      };
       auto cursor = lmdb::cursor::open(rtxn, dbi);
-      if (!checkvaluetoo) {
-        lmdb::val key;
-        while (cursor.get(key, MDB_NEXT)) {
-          dbi0.del(wtxn0, key);
+      lmdb::val val0;
+      for (const auto &e : cursor.range()) {
+        if (!may_contain(e.key)) {
+          continue;
         }
-      } else {
-        lmdb::val key, val, val0;
-        string s, s0;
-        while (cursor.get(key, val, MDB_NEXT)) {
-          if (dbi0.get(wtxn0, key, val0)) {
-            const string s(val.data(), val.size());
-            const string s0(val0.data(), val0.size());
-            if (s == s0) {
-              dbi0.del(wtxn0, key);
-            }
-          }
+        if (checkvaluetoo
+            && (!lmdb::dbi_get(writer0.txn(), writer0.dbi(), e.key, val0)
+                || !((same && equal(val0, e.value))
+                     || equal(codec0.decode(val0, buf0),
+                              codec.decode(e.value, buf))))) {
+          continue;
         }
+        writer0.del(e.key);
       }
       cursor.close();
       rtxn.abort();
     }
 
-    MDB_stat st = dbi0.stat(wtxn0);
+    MDB_stat st = writer0.stat();
     cout << tdbfname << '\t' << st.ms_entries << endl;
-    wtxn0.commit();
+    writer0.commit();
+
+    if (!filter.empty()) {
+      auto rtxn0 = lmdb::txn::begin(env0, nullptr, MDB_RDONLY);
+      const auto stamp = lmdbtools::filter_stamp::of(rtxn0, writer0.dbi());
+      rtxn0.abort();
+      if (!lmdbtools::bloom_filter::restamp(filterfname, stamp)) {
+        cerr << filterfname << ": " << strerror(errno) << endl;
+      }
+    }
+    if (verbose > 0) {
+      cerr << "filtered " << filtered << endl;
+    }
   }
   catch (const lmdb::error &e) {
     cerr << e.what() << endl;
     return EXIT_FAILURE;
   }
+  catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
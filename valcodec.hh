@@ -0,0 +1,428 @@
+#ifndef LMDBTOOLS_VALCODEC_HH
+#define LMDBTOOLS_VALCODEC_HH
+
+/**
+ * Dictionary compression and out-of-line storage of the values of a
+ * database.
+ *
+ * Small values share little with themselves but much with each other, so
+ * each value is deflated on its own against a preset dictionary of the
+ * strings common to the values (RFC 1950, section 2.2), trained from a
+ * sample of them. Values larger than a threshold are appended to the blob
+ * file of the database, and the database holds a reference to them. The
+ * dictionary and the threshold are kept in the metadata of the database,
+ * and every value of a database with either is encoded: a tag byte, 0 for
+ * a value stored as is, 1 for a deflated one, which is followed by the
+ * varint length of the value and its raw deflate stream, and 2 for a
+ * reference, which is followed by the 64-bit offset and length and the
+ * CRC-32 of the encoded value in the blob file.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+#include "lmdb++.h"
+#include "blobfile.hh"
+#include "metadata.hh"
+
+namespace lmdbtools {
+
+class value_codec {
+  enum : unsigned char { stored = 0, deflated = 1, reference = 2 };
+  static constexpr std::size_t reference_size = 1 + 8 + 8 + 4;
+
+  std::shared_ptr<const std::string> _dict;  // nullptr: values as they are
+  std::size_t _blob_threshold{0};  // 0: no blob file
+  std::shared_ptr<blob_file> _blobs;  // of the database, opened lazily
+  std::string _fetched;  // encoded value read from the blob file
+  z_stream _primed{};  // deflate stream that has just read the dictionary
+  z_stream _deflate{};
+  z_stream _inflate{};
+  bool _primed_ready{false};
+  bool _deflate_ready{false};
+  bool _inflate_ready{false};
+
+  void end() noexcept {
+    if (_primed_ready) ::deflateEnd(&_primed);
+    if (_deflate_ready) ::deflateEnd(&_deflate);
+    if (_inflate_ready) ::inflateEnd(&_inflate);
+    _primed_ready = _deflate_ready = _inflate_ready = false;
+  }
+
+  const Bytef* dict_data() const noexcept {
+    return reinterpret_cast<const Bytef*>(_dict->data());
+  }
+
+  [[noreturn]] static void corrupt() {
+    throw std::runtime_error("corrupt encoded value");
+  }
+
+  static value_codec of(const std::string& dbname, const metadata& meta) {
+    const std::string* const dict = meta.find("dictionary");
+    const std::string* const threshold = meta.find("blob-threshold");
+    value_codec codec(dict ? *dict : std::string(),
+                      threshold ? std::stoul(*threshold) : 0);
+    if (codec._blob_threshold > 0) {
+      codec._blobs = std::make_shared<blob_file>(blob_file::path_of(dbname));
+    }
+    return codec;
+  }
+
+  // Deflates a value against the dictionary into `buf`, tagged.
+  void compress(const lmdb::val& value, std::string& buf) {
+    // hashing the dictionary costs several times more than deflating a
+    // small value, so each value starts from a copy of a stream that has
+    // read the dictionary once
+    if (!_primed_ready) {
+      // a raw deflate stream; the codec records no checksum
+      if (::deflateInit2(&_primed, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15,
+                         8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("deflateInit2: failed");
+      }
+      _primed_ready = true;
+      if (::deflateSetDictionary(&_primed, dict_data(),
+                                 static_cast<uInt>(_dict->size())) != Z_OK) {
+        throw std::runtime_error("deflateSetDictionary: failed");
+      }
+    }
+    if (_deflate_ready) ::deflateEnd(&_deflate);
+    _deflate_ready = ::deflateCopy(&_deflate, &_primed) == Z_OK;
+    if (!_deflate_ready) throw std::runtime_error("deflateCopy: failed");
+    buf.assign(1, static_cast<char>(deflated));
+    for (std::size_t n = value.size(); ; n >>= 7) {
+      buf += static_cast<char>((n & 0x7f) | (n >= 0x80 ? 0x80 : 0));
+      if (n < 0x80) break;
+    }
+    const std::size_t header = buf.size();
+    buf.resize(header + ::deflateBound(&_deflate, value.size()));
+    _deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(value.data()));
+    _deflate.avail_in = static_cast<uInt>(value.size());
+    _deflate.next_out = reinterpret_cast<Bytef*>(&buf[header]);
+    _deflate.avail_out = static_cast<uInt>(buf.size() - header);
+    if (::deflate(&_deflate, Z_FINISH) != Z_STREAM_END) {
+      throw std::runtime_error(std::string("deflate: ")
+                               + (_deflate.msg ? _deflate.msg : "failed"));
+    }
+    buf.resize(buf.size() - _deflate.avail_out);
+    if (buf.size() > value.size()) {  // incompressible
+      buf.assign(1, static_cast<char>(stored));
+      buf.append(value.data(), value.size());
+    }
+  }
+
+  // Decodes a value tagged stored or deflated; a stored one is returned in
+  // place.
+  lmdb::val expand(const unsigned char* p, std::size_t size,
+                   std::string& buf) {
+    const unsigned char* const end = p + size;
+    if (p == end) corrupt();
+    if (*p == stored) return lmdb::val{p + 1, size - 1};
+    if (*p++ != deflated || !_dict) corrupt();
+    std::size_t n = 0;
+    for (unsigned int shift = 0; ; shift += 7) {
+      if (p == end || shift > 56) corrupt();
+      n |= static_cast<std::size_t>(*p & 0x7f) << shift;
+      if (!(*p++ & 0x80)) break;
+    }
+    // deflate expands a byte into at most 1032, so a larger length is
+    // garbage, not a value to allocate
+    if (n / 1032 > static_cast<std::size_t>(end - p)
+        || n > std::numeric_limits<uInt>::max()) {
+      corrupt();
+    }
+    if (!_inflate_ready) {
+      if (::inflateInit2(&_inflate, -15) != Z_OK) {
+        throw std::runtime_error("inflateInit2: failed");
+      }
+      _inflate_ready = true;
+    } else if (::inflateReset(&_inflate) != Z_OK) {
+      throw std::runtime_error("inflateReset: failed");
+    }
+    if (::inflateSetDictionary(&_inflate, dict_data(),
+                               static_cast<uInt>(_dict->size())) != Z_OK) {
+      throw std::runtime_error("inflateSetDictionary: failed");
+    }
+    buf.resize(n);
+    _inflate.next_in = const_cast<Bytef*>(p);
+    _inflate.avail_in = static_cast<uInt>(end - p);
+    _inflate.next_out = reinterpret_cast<Bytef*>(&buf[0]);
+    _inflate.avail_out = static_cast<uInt>(n);
+    if (::inflate(&_inflate, Z_FINISH) != Z_STREAM_END
+        || _inflate.avail_out != 0) {
+      corrupt();
+    }
+    return lmdb::val{buf};
+  }
+
+public:
+  /** Dictionary bytes trained by default; a deflate window holds 32 KiB. */
+  static constexpr std::size_t default_dict_size = 16UL << 10;
+  static constexpr std::size_t max_dict_size = 32UL << 10;
+
+  value_codec() noexcept = default;
+
+  /**
+   * A codec to be adopted by a database: compression with a dictionary,
+   * unless it is empty, and the values of more than `blob_threshold`
+   * bytes, once compressed, out of line, unless it is 0.
+   */
+  explicit value_codec(std::string dict, std::size_t blob_threshold = 0)
+    : _dict{dict.empty() ? nullptr
+            : std::make_shared<const std::string>(std::move(dict))},
+      _blob_threshold{blob_threshold} {}
+
+  /**
+   * A copy shares the dictionary and the blob file and has streams of its
+   * own, so that each thread can code with its own copy.
+   */
+  value_codec(const value_codec& other) noexcept
+    : _dict{other._dict},
+      _blob_threshold{other._blob_threshold},
+      _blobs{other._blobs} {}
+
+  value_codec& operator=(const value_codec& other) noexcept {
+    if (this != &other) {
+      end();
+      _dict = other._dict;
+      _blob_threshold = other._blob_threshold;
+      _blobs = other._blobs;
+    }
+    return *this;
+  }
+
+  ~value_codec() noexcept {
+    end();
+  }
+
+  /**
+   * Returns the codec of the values of database `dbname`.
+   *
+   * @throws lmdb::error on failure to read the metadata
+   */
+  static value_codec of(const std::string& dbname) {
+    return of(dbname, metadata::load(dbname));
+  }
+
+  /**
+   * Whether values are encoded, compressed or out of line.
+   */
+  bool active() const noexcept {
+    return _dict || _blob_threshold > 0;
+  }
+
+  std::size_t blob_threshold() const noexcept { return _blob_threshold; }
+
+  const std::string& dictionary() const noexcept {
+    static const std::string none;
+    return _dict ? *_dict : none;
+  }
+
+  /**
+   * Whether two codecs encode values alike, so that an encoded value can
+   * be copied from one database to the other as it is. A reference is only
+   * valid in its own database.
+   */
+  bool operator==(const value_codec& other) const noexcept {
+    return _blob_threshold == 0 && other._blob_threshold == 0
+      && (_dict == other._dict
+          || (_dict && other._dict && *_dict == *other._dict));
+  }
+
+  bool operator!=(const value_codec& other) const noexcept {
+    return !(*this == other);
+  }
+
+  /**
+   * Encodes a value into `buf`, or returns it as it is if values are not
+   * encoded. A value stored out of line is appended to the blob file.
+   *
+   * @throws std::runtime_error on failure
+   */
+  lmdb::val encode(const lmdb::val& value, std::string& buf) {
+    if (!active()) return lmdb::val{value.data(), value.size()};
+    if (_dict) {
+      compress(value, buf);
+    } else {
+      buf.assign(1, static_cast<char>(stored));
+      buf.append(value.data(), value.size());
+    }
+    if (_blobs && buf.size() > _blob_threshold) {
+      const std::uint64_t size = buf.size();
+      const std::uint32_t crc = ::crc32(
+        0, reinterpret_cast<const Bytef*>(buf.data()), buf.size());
+      const std::uint64_t offset = _blobs->append(buf.data(), buf.size());
+      buf.assign(1, static_cast<char>(reference));
+      buf.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+      buf.append(reinterpret_cast<const char*>(&size), sizeof(size));
+      buf.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+    }
+    return lmdb::val{buf};
+  }
+
+  /**
+   * Decodes a value into `buf`, or returns it as it is, or the part of it
+   * that holds it, without copying. A reference is read from the blob file
+   * only now.
+   *
+   * @throws std::runtime_error on a value that is not a valid encoding
+   */
+  lmdb::val decode(const lmdb::val& value, std::string& buf) {
+    if (!active()) return lmdb::val{value.data(), value.size()};
+    const unsigned char* const p =
+      reinterpret_cast<const unsigned char*>(value.data());
+    if (value.size() == 0 || *p != reference) {
+      return expand(p, value.size(), buf);
+    }
+    std::uint64_t offset, size;
+    std::uint32_t crc;
+    if (!_blobs || value.size() != reference_size) corrupt();
+    std::memcpy(&offset, p + 1, sizeof(offset));
+    std::memcpy(&size, p + 9, sizeof(size));
+    std::memcpy(&crc, p + 17, sizeof(crc));
+    if (!_blobs->read(offset, size, _fetched)
+        || ::crc32(0, reinterpret_cast<const Bytef*>(_fetched.data()),
+                   _fetched.size()) != crc) {
+      throw std::runtime_error(_blobs->path() + ": corrupt value at offset "
+                               + std::to_string(offset));
+    }
+    const unsigned char* const q =
+      reinterpret_cast<const unsigned char*>(_fetched.data());
+    if (size == 0 || *q == reference) corrupt();
+    const lmdb::val v = expand(q, size, buf);
+    if (v.data() != buf.data()) {  // in place in the fetched copy
+      buf.assign(v.data(), v.size());
+    }
+    return lmdb::val{buf};
+  }
+
+  /**
+   * Flushes the values appended to the blob file, ahead of the commit of
+   * the entries that refer to them.
+   *
+   * @throws std::system_error on failure
+   */
+  void sync() {
+    if (_blobs) _blobs->sync();
+  }
+
+  /**
+   * Trains a dictionary of at most `size` bytes from sample values.
+   *
+   * The samples are cut into as many stretches as the dictionary has
+   * segments, and the segment of each stretch is the one whose 8-byte
+   * substrings occur in the most samples, not counting the substrings an
+   * earlier segment took (the COVER algorithm of zstd's dictionary
+   * builder). The segments go into the dictionary in the order of their
+   * scores, the best last, which deflate reaches with the shortest
+   * distances.
+   */
+  static std::string train(const std::vector<std::string>& samples,
+                           std::size_t size = default_dict_size) {
+    constexpr std::size_t d = 8;  // substring length
+    constexpr std::size_t k = 64;  // segment length
+    if (size > max_dict_size) size = max_dict_size;
+
+    std::string all;  // the samples end to end
+    std::vector<std::size_t> ends;
+    for (const auto& s : samples) {
+      all += s;
+      ends.push_back(all.size());
+    }
+    if (all.size() <= size || size < k) return all.substr(0, size);
+
+    // number of samples each substring occurs in; 0 for the positions
+    // whose substring crosses the end of a sample
+    auto key_at = [&all](std::size_t i) {
+      std::uint64_t key;
+      std::memcpy(&key, all.data() + i, d);
+      return key;
+    };
+    std::unordered_map<std::uint64_t, std::uint32_t> freq;
+    std::vector<bool> whole(all.size(), false);
+    std::size_t begin = 0;
+    for (const std::size_t end : ends) {
+      std::unordered_map<std::uint64_t, bool> seen;
+      for (std::size_t i = begin; i + d <= end; ++i) {
+        whole[i] = true;
+        if (seen.emplace(key_at(i), true).second) ++freq[key_at(i)];
+      }
+      begin = end;
+    }
+    auto score_at = [&](std::size_t i) -> std::uint64_t {
+      if (!whole[i]) return 0;
+      const auto it = freq.find(key_at(i));
+      return it->second > 1 ? it->second : 0;
+    };
+
+    struct segment {
+      std::uint64_t score;
+      std::size_t offset;
+    };
+    std::vector<segment> chosen;
+    const std::size_t nsegs = size / k;
+    const std::size_t stretch = all.size() / nsegs;
+    for (std::size_t e = 0; e < nsegs; ++e) {
+      const std::size_t lo = e * stretch;
+      const std::size_t hi = std::min(lo + stretch, all.size() - k + 1);
+      if (lo >= hi) break;
+      // sliding sum of the substring scores of the segments in the stretch
+      std::uint64_t sum = 0;
+      for (std::size_t i = lo; i + d <= lo + k; ++i) sum += score_at(i);
+      segment best{sum, lo};
+      for (std::size_t i = lo + 1; i < hi; ++i) {
+        sum -= score_at(i - 1);
+        sum += score_at(i + k - d);
+        if (sum > best.score) best = segment{sum, i};
+      }
+      if (best.score == 0) continue;
+      chosen.push_back(best);
+      for (std::size_t i = best.offset; i + d <= best.offset + k; ++i) {
+        if (whole[i]) freq[key_at(i)] = 0;
+      }
+    }
+    std::stable_sort(chosen.begin(), chosen.end(),
+                     [](const segment& a, const segment& b) {
+      return a.score < b.score;
+    });
+    std::string dict;
+    for (const auto& s : chosen) dict.append(all, s.offset, k);
+    return dict;
+  }
+
+  /**
+   * Makes this the codec of the values of database `dbname`, if it has
+   * none, is empty and this codec encodes values, and returns the codec the
+   * values of the database are written with.
+   *
+   * @throws lmdb::error on failure
+   */
+  value_codec adopt(const std::string& dbname,
+                    lmdb::batch_writer& writer) const {
+    metadata meta = metadata::load(dbname);
+    if (meta.find("dictionary") || meta.find("blob-threshold") || !active()
+        || writer.stat().ms_entries > 0) {
+      return of(dbname, meta);
+    }
+    if (_dict) {
+      meta.set("dictionary", *_dict);
+    }
+    if (_blob_threshold > 0) {
+      meta.set("blob-threshold", std::to_string(_blob_threshold));
+    }
+    meta.save(dbname);
+    return of(dbname, meta);
+  }
+};
+
+}  // namespace lmdbtools
+
+#endif  // LMDBTOOLS_VALCODEC_HH